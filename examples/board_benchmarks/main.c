@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ *
+ * This example measures the RP2040 board layer on the target and prints
+ * the results. It needs an SX1262 radio module, but no network.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hardware/clocks.h"
+#include "hardware/spi.h"
+#include "hardware/structs/systick.h"
+#include "pico/board-config.h"
+#include "pico/board-rp2040.h"
+#include "pico/lorawan.h"
+#include "pico/stdlib.h"
+#include "sx126x-board.h"
+#include "timer.h"
+#include "tusb.h"
+
+// pin configuration for SX1262 radio module
+const struct lorawan_sx126x_settings sx126x_settings = {.spi = {.inst = spi0,
+                                                                .mosi = PICO_DEFAULT_SPI_TX_PIN,
+                                                                .miso = PICO_DEFAULT_SPI_RX_PIN,
+                                                                .sck = PICO_DEFAULT_SPI_SCK_PIN,
+                                                                .nss = RADIO_NSS},
+                                                        .reset = RADIO_RESET,
+                                                        .dio1 = RADIO_DIO_1};
+
+// LoRaWAN region to use, full list of regions can be found at:
+//   http://stackforce.github.io/LoRaMac-doc/LoRaMac-doc-v4.5.1/group___l_o_r_a_m_a_c.html#ga3b9d54f0355b51e85df8b33fd1757eec
+#define LORAWAN_REGION LORAMAC_REGION_US915
+
+// number of times each operation is repeated
+#define ITERATIONS 100
+
+// SysTick counts down from 2^24 - 1 at clk_sys
+static void cycles_start(void) {
+  systick_hw->csr = 0;
+  systick_hw->rvr = 0x00ffffff;
+  systick_hw->cvr = 0;
+  systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+}
+
+static uint32_t cycles_stop(void) { return 0x00ffffff - systick_hw->cvr; }
+
+static uint8_t buffer[242];
+
+struct spi_result {
+  uint32_t cycles; // CPU cycles per call, average
+  uint32_t us;     // NSS low time per transaction, average
+};
+
+static void measure_spi_op(int op, struct spi_result *result) {
+  SX126xTransferStats_t stats;
+  uint64_t cycles = 0;
+
+  SX126xResetTransferStats();
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    cycles_start();
+    switch (op) {
+      case 0:
+        SX126xReadBuffer(0, buffer, 4);
+        break;
+      case 1:
+        SX126xWriteBuffer(0, buffer, 8);
+        break;
+      default:
+        SX126xReadBuffer(0, buffer, sizeof(buffer));
+        break;
+    }
+    cycles += cycles_stop();
+  }
+
+  SX126xGetTransferStats(&stats);
+
+  result->cycles = cycles / ITERATIONS;
+  result->us = (stats.Count != 0) ? (stats.TotalUs / stats.Count) : 0;
+}
+
+static void bench_spi(void) {
+  static const char *names[] = {"ReadBuffer 4", "WriteBuffer 8", "ReadBuffer 242"};
+  struct spi_result spi[3];
+  struct spi_result pio[3];
+
+  printf("\nSX126x transfers, hardware SPI vs PIO engine, %u iterations\n", ITERATIONS);
+
+  for (int op = 0; op < 3; op++) {
+    measure_spi_op(op, &spi[op]);
+  }
+
+  // Same pins, the PIO engine takes them over from the hardware SPI block
+  SpiPioInit(&SX126x.Spi, pio0, sx126x_settings.spi.mosi, sx126x_settings.spi.miso,
+             sx126x_settings.spi.sck, sx126x_settings.spi.nss, SX126x.BUSY.pin);
+
+  for (int op = 0; op < 3; op++) {
+    measure_spi_op(op, &pio[op]);
+  }
+
+  printf("%-16s %12s %12s %12s %12s\n", "operation", "SPI cycles", "PIO cycles", "SPI us",
+         "PIO us");
+  for (int op = 0; op < 3; op++) {
+    printf("%-16s %12lu %12lu %12lu %12lu\n", names[op], spi[op].cycles, pio[op].cycles,
+           spi[op].us, pio[op].us);
+  }
+}
+
+// timers running during the alarm benchmark, the size of the SDK alarm pool
+#define ALARMS 16
+
+static TimerEvent_t timers[ALARMS];
+
+static volatile bool fired;
+
+static volatile uint64_t pool_target;
+
+static volatile uint64_t pool_latency_us;
+
+static void on_timer(void *context) { fired = true; }
+
+static int64_t on_pool_alarm(alarm_id_t id, void *user_data) {
+  pool_latency_us += time_us_64() - pool_target;
+  fired = true;
+
+  return 0;
+}
+
+static void bench_alarms(void) {
+  alarm_pool_t *pool = alarm_pool_create_with_unused_hardware_alarm(ALARMS);
+  alarm_id_t ids[ALARMS];
+  RtcAlarmStats_t stats;
+  uint64_t timer_cycles = 0;
+  uint64_t pool_cycles = 0;
+
+  printf("\nAlarms, board timers vs SDK alarm pool, %u running, %u iterations\n", ALARMS,
+         ITERATIONS);
+
+  // Reschedule one of ALARMS far away alarms, as the MAC does with its timers
+  for (int i = 0; i < ALARMS; i++) {
+    TimerInit(&timers[i], on_timer);
+    TimerSetValue(&timers[i], 10000 + i);
+    TimerStart(&timers[i]);
+    ids[i] = alarm_pool_add_alarm_in_ms(pool, 10000 + i, on_pool_alarm, NULL, true);
+  }
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    TimerEvent_t *timer = &timers[i % ALARMS];
+
+    cycles_start();
+    TimerStop(timer);
+    TimerSetValue(timer, 10000 + i);
+    TimerStart(timer);
+    timer_cycles += cycles_stop();
+
+    cycles_start();
+    alarm_pool_cancel_alarm(pool, ids[i % ALARMS]);
+    ids[i % ALARMS] = alarm_pool_add_alarm_in_ms(pool, 10000 + i, on_pool_alarm, NULL, true);
+    pool_cycles += cycles_stop();
+  }
+
+  for (int i = 0; i < ALARMS; i++) {
+    TimerStop(&timers[i]);
+    alarm_pool_cancel_alarm(pool, ids[i]);
+  }
+
+  // Delay from the alarm target to the first code that runs for it
+  RtcResetAlarmStats();
+  pool_latency_us = 0;
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    fired = false;
+    TimerSetValue(&timers[0], 2);
+    TimerStart(&timers[0]);
+    while (!fired) {
+      tight_loop_contents();
+    }
+
+    fired = false;
+    pool_target = time_us_64() + 2000;
+    alarm_pool_add_alarm_at(pool, from_us_since_boot(pool_target), on_pool_alarm, NULL, true);
+    while (!fired) {
+      tight_loop_contents();
+    }
+  }
+
+  RtcGetAlarmStats(&stats);
+  alarm_pool_destroy(pool);
+
+  printf("%-24s %12s %12s\n", "", "timers", "alarm pool");
+  printf("%-24s %12lu %12lu\n", "reschedule cycles", (uint32_t)(timer_cycles / ITERATIONS),
+         (uint32_t)(pool_cycles / ITERATIONS));
+  printf("%-24s %12lu %12lu\n", "IRQ latency us",
+         (stats.Fired != 0) ? (uint32_t)(stats.TotalLatencyUs / stats.Fired) : 0,
+         (uint32_t)(pool_latency_us / ITERATIONS));
+  printf("%-24s %12lu %12s\n", "IRQ latency us, max", stats.MaxLatencyUs, "");
+}
+
+// application work run in slices by an idle hook, a checksum over a buffer
+static volatile uint32_t work_slices;
+
+static void idle_work(void *context) {
+  uint32_t sum = 0;
+
+  for (size_t i = 0; i < sizeof(buffer); i++) {
+    sum = (sum << 1) ^ buffer[i] ^ (sum >> 31);
+  }
+  buffer[0] = sum;
+  work_slices++;
+}
+
+static void print_startup(uint64_t init_us) {
+  DelayStats_t stats;
+
+  DelayGetStats(&stats);
+
+  printf("\nStartup, lorawan_init() with an idle hook, radio reset and TCXO waits included\n");
+  printf("%-24s %12lu\n", "lorawan_init() us", (uint32_t)init_us);
+  printf("%-24s %12lu\n", "yielding delays", stats.Yielding);
+  printf("%-24s %12lu\n", "yielding delay us", (uint32_t)stats.YieldingUs);
+  printf("%-24s %12lu\n", "idle hook us", (uint32_t)stats.HookUs);
+  printf("%-24s %12lu\n", "idle hook slices", work_slices);
+  printf("%-24s %12lu\n", "busy delays", stats.Busy);
+  printf("%-24s %12lu\n", "busy delay us", (uint32_t)stats.BusyUs);
+}
+
+int main(void) {
+  // initialize stdio and wait for USB CDC connect
+  stdio_init_all();
+
+  while (!tud_cdc_connected()) {
+    tight_loop_contents();
+  }
+  printf("Pico LoRaWAN - Board Benchmarks\n\n");
+
+  printf("clk_sys: %lu Hz\n", clock_get_hz(clk_sys));
+
+  // the hook gets the CPU while the radio boots
+  DelayResetStats();
+  DelayAddIdleHook(idle_work, NULL);
+
+  // initialize the LoRaWAN stack
+  printf("Initilizating LoRaWAN ... ");
+  uint64_t start = time_us_64();
+  int status = lorawan_init(&sx126x_settings, LORAWAN_REGION);
+  uint64_t init_us = time_us_64() - start;
+
+  DelayRemoveIdleHook(idle_work, NULL);
+
+  if (status < 0) {
+    printf("failed!!!\n");
+    while (1) {
+      tight_loop_contents();
+    }
+  } else {
+    printf("success!\n");
+  }
+
+  print_startup(init_us);
+
+  bench_alarms();
+
+  // the PIO engine is switched on during the SPI benchmark and stays on
+  bench_spi();
+
+  printf("\ndone\n");
+
+  while (1) {
+    tight_loop_contents();
+  }
+}
@@ -9,10 +9,163 @@
 #include <string.h>
 
 #include "pico.h"
+#include "pico/time.h"
 #include "pico/unique_id.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/regs/m0plus.h"
+#include "hardware/structs/scb.h"
 #include "hardware/sync.h"
+#include "hardware/uart.h"
+#include "hardware/watchdog.h"
 
 #include "board.h"
+#include "rtc-board.h"
+#include "pico/board-rp2040.h"
+
+/*!
+ * Clocks stopped while the core sleeps, peripherals this library never uses
+ * from an interrupt or DMA. The ROM and XIP clocks are only needed by the
+ * core itself. The gating only applies in deep sleep, with SLEEPDEEP set.
+ */
+#ifndef BOARD_SLEEP_GATED_EN0
+#define BOARD_SLEEP_GATED_EN0 (CLOCKS_SLEEP_EN0_CLK_SYS_ADC_BITS | CLOCKS_SLEEP_EN0_CLK_ADC_ADC_BITS | \
+                               CLOCKS_SLEEP_EN0_CLK_SYS_I2C0_BITS | CLOCKS_SLEEP_EN0_CLK_SYS_I2C1_BITS | \
+                               CLOCKS_SLEEP_EN0_CLK_SYS_JTAG_BITS | CLOCKS_SLEEP_EN0_CLK_SYS_PWM_BITS | \
+                               CLOCKS_SLEEP_EN0_CLK_SYS_ROM_BITS | CLOCKS_SLEEP_EN0_CLK_SYS_RTC_BITS | \
+                               CLOCKS_SLEEP_EN0_CLK_RTC_RTC_BITS)
+#endif
+
+#ifndef BOARD_SLEEP_GATED_EN1
+#define BOARD_SLEEP_GATED_EN1 (CLOCKS_SLEEP_EN1_CLK_SYS_TBMAN_BITS | CLOCKS_SLEEP_EN1_CLK_SYS_XIP_BITS)
+#endif
+
+static BoardPowerStats_t BoardPowerStats;
+
+/*!
+ * Start of the current statistics window [us since boot]
+ */
+static uint64_t BoardPowerStatsStart;
+
+static inline uint32_t BoardPendingIrqs( void )
+{
+    return *(io_rw_32 *)(PPB_BASE + M0PLUS_NVIC_ISPR_OFFSET);
+}
+
+/*!
+ * \brief Checks whether lowering clk_sys would disturb a peripheral
+ *
+ * clk_peri follows clk_sys, so a DMA transfer in flight or a UART that can
+ * receive keeps the full clock. A byte arriving at the lowered clock would
+ * be sampled at the wrong baud rate. A UART transmission is drained first.
+ */
+static bool BoardCanLowerClock( void )
+{
+    for (uint i = 0; i < NUM_DMA_CHANNELS; i++) {
+        if (dma_channel_is_busy(i)) {
+            return false;
+        }
+    }
+
+    uart_inst_t *uarts[] = { uart0, uart1 };
+
+    for (uint i = 0; i < count_of(uarts); i++) {
+        if (uart_is_enabled(uarts[i]) && (uart_get_hw(uarts[i])->cr & UART_UARTCR_RXE_BITS)) {
+            return false;
+        }
+    }
+
+    for (uint i = 0; i < count_of(uarts); i++) {
+        if (uart_is_enabled(uarts[i])) {
+            uart_tx_wait_blocking(uarts[i]);
+        }
+    }
+
+    return true;
+}
+
+static void BoardAccountWakeup( uint32_t pending )
+{
+    if (pending & (1u << RtcGetAlarmIrq())) {
+        BoardPowerStats.WakeRtc++;
+    } else if (pending & (1u << IO_IRQ_BANK0)) {
+        BoardPowerStats.WakeGpio++;
+    } else if (pending & ((1u << TIMER_IRQ_0) | (1u << TIMER_IRQ_1) | (1u << TIMER_IRQ_2) | (1u << TIMER_IRQ_3))) {
+        BoardPowerStats.WakeTimer++;
+    } else if (pending & (1u << USBCTRL_IRQ)) {
+        BoardPowerStats.WakeUsb++;
+    } else {
+        BoardPowerStats.WakeOther++;
+    }
+}
+
+/*!
+ * \brief Sleeps until an interrupt is pending
+ *
+ * Runs with interrupts masked, WFI still returns on a pending interrupt and
+ * the handler runs once the caller unmasks them, after the clocks are back.
+ * The timer counts the 1 us watchdog tick from clk_ref, so the timebase
+ * stays exact while clk_sys is lowered.
+ *
+ * \param [IN] wakeUs Expected wakeup time [us since boot], 0 if unknown
+ */
+static void BoardSleep( uint64_t wakeUs )
+{
+    uint32_t mask = save_and_disable_interrupts();
+    uint64_t start = time_us_64();
+    uint32_t sysHz = 0;
+
+    if (BoardPendingIrqs() != 0) {
+        restore_interrupts(mask);
+        return;
+    }
+
+    // Without a known wakeup only an interrupt ends the sleep, assume it is long
+    if (((wakeUs == 0) || (wakeUs > start + BOARD_LOW_POWER_XOSC_MIN_US)) && BoardCanLowerClock()) {
+        sysHz = clock_get_hz(clk_sys);
+        clock_configure(clk_sys, CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLK_REF, 0,
+                        clock_get_hz(clk_ref), clock_get_hz(clk_ref));
+    }
+
+    uint32_t en0 = clocks_hw->sleep_en0;
+    uint32_t en1 = clocks_hw->sleep_en1;
+
+    clocks_hw->sleep_en0 = en0 & ~(BOARD_SLEEP_GATED_EN0);
+    clocks_hw->sleep_en1 = en1 & ~(BOARD_SLEEP_GATED_EN1);
+
+    // The sleep_en registers only gate clocks once the core is in deep sleep
+    scb_hw->scr |= M0PLUS_SCR_SLEEPDEEP_BITS;
+    __wfi();
+    scb_hw->scr &= ~M0PLUS_SCR_SLEEPDEEP_BITS;
+
+    clocks_hw->sleep_en0 = en0;
+    clocks_hw->sleep_en1 = en1;
+
+    if (sysHz != 0) {
+        clock_configure(clk_sys, CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLKSRC_CLK_SYS_AUX,
+                        CLOCKS_CLK_SYS_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS, sysHz, sysHz);
+    }
+
+    uint64_t elapsed = time_us_64() - start;
+
+    if (sysHz != 0) {
+        BoardPowerStats.LowClockSleeps++;
+        BoardPowerStats.LowClockSleepUs += elapsed;
+    } else {
+        BoardPowerStats.Sleeps++;
+        BoardPowerStats.SleepUs += elapsed;
+    }
+    BoardAccountWakeup(BoardPendingIrqs());
+
+    restore_interrupts(mask);
+}
+
+static int64_t BoardWakeAlarm( alarm_id_t id, void *context )
+{
+    // The interrupt itself ends the sleep
+    return 0;
+}
 
 void BoardInitMcu( void )
 {
@@ -24,7 +177,48 @@ void BoardInitPeriph( void )
 
 void BoardLowPowerHandler( void )
 {
-    __wfi();
+    BoardSleep(RtcGetAlarmTarget());
+}
+
+void BoardLowPowerHandlerUntil( absolute_time_t deadline )
+{
+    uint64_t wakeUs = to_us_since_boot(deadline);
+    uint64_t alarmUs = RtcGetAlarmTarget();
+
+    alarm_id_t id = add_alarm_at(deadline, BoardWakeAlarm, NULL, false);
+
+    if (id <= 0) {
+        // Already reached, or no alarm slot left to wake up on time
+        return;
+    }
+
+    if ((alarmUs != 0) && (alarmUs < wakeUs)) {
+        wakeUs = alarmUs;
+    }
+
+    BoardSleep(wakeUs);
+
+    cancel_alarm(id);
+}
+
+void BoardGetPowerStats( BoardPowerStats_t *stats )
+{
+    uint32_t mask = save_and_disable_interrupts();
+
+    *stats = BoardPowerStats;
+    stats->ActiveUs = time_us_64() - BoardPowerStatsStart - stats->SleepUs - stats->LowClockSleepUs;
+
+    restore_interrupts(mask);
+}
+
+void BoardResetPowerStats( void )
+{
+    uint32_t mask = save_and_disable_interrupts();
+
+    memset(&BoardPowerStats, 0, sizeof(BoardPowerStats));
+    BoardPowerStatsStart = time_us_64();
+
+    restore_interrupts(mask);
 }
 
 uint8_t BoardGetBatteryLevel( void )
@@ -62,4 +256,12 @@ void BoardCriticalSectionEnd( uint32_t *mask )
 
 void BoardResetMcu( void )
 {
+    // NVM changes may still wait for an idle radio
+    EepromMcuFlush();
+
+    watchdog_reboot(0, 0, 0);
+
+    while (1) {
+        tight_loop_contents();
+    }
 }
@@ -5,11 +5,110 @@
  * 
  */
 
+#include "pico/time.h"
+#include "hardware/sync.h"
 #include "hardware/timer.h"
 
 #include "delay-board.h"
+#include "pico/board-rp2040.h"
+
+static struct {
+    DelayIdleHook *Hook;
+    void *Context;
+} DelayIdleHooks[DELAY_IDLE_HOOKS_MAX];
+
+static DelayStats_t DelayStats;
+
+/*!
+ * Set while the idle hooks run, delays nested in a hook busy wait
+ */
+static bool DelayInHooks = false;
+
+bool DelayAddIdleHook( DelayIdleHook *hook, void *context )
+{
+    for (uint32_t i = 0; i < DELAY_IDLE_HOOKS_MAX; i++) {
+        if (DelayIdleHooks[i].Hook == NULL) {
+            DelayIdleHooks[i].Context = context;
+            DelayIdleHooks[i].Hook = hook;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void DelayRemoveIdleHook( DelayIdleHook *hook, void *context )
+{
+    for (uint32_t i = 0; i < DELAY_IDLE_HOOKS_MAX; i++) {
+        if ((DelayIdleHooks[i].Hook == hook) && (DelayIdleHooks[i].Context == context)) {
+            DelayIdleHooks[i].Hook = NULL;
+        }
+    }
+}
+
+static void DelayRunIdleHooks( void )
+{
+    uint64_t start = time_us_64();
+
+    DelayInHooks = true;
+
+    for (uint32_t i = 0; i < DELAY_IDLE_HOOKS_MAX; i++) {
+        DelayIdleHook *hook = DelayIdleHooks[i].Hook;
+
+        if (hook != NULL) {
+            hook(DelayIdleHooks[i].Context);
+        }
+    }
+
+    DelayInHooks = false;
+
+    DelayStats.HookUs += time_us_64() - start;
+}
+
+/*!
+ * \brief Checks whether the caller can sleep until a timer interrupt
+ *
+ * WFE is only woken by the timer from thread mode with interrupts enabled
+ */
+static bool DelayCanYield( void )
+{
+    uint32_t status = save_and_disable_interrupts();
+
+    restore_interrupts(status);
+
+    return (__get_current_exception() == 0) && ((status & 1) == 0) && !DelayInHooks;
+}
 
 void DelayMsMcu( uint32_t ms )
 {
-    busy_wait_us_32(ms * 1000);
+    uint64_t start = time_us_64();
+
+    if (!DelayCanYield()) {
+        busy_wait_us(ms * 1000ull);
+
+        DelayStats.Busy++;
+        DelayStats.BusyUs += time_us_64() - start;
+        return;
+    }
+
+    absolute_time_t deadline = from_us_since_boot(start + ms * 1000ull);
+
+    // The hooks run at least once, then after every wakeup until the
+    // deadline, which the timeout of the WFE guarantees
+    do {
+        DelayRunIdleHooks();
+    } while (!time_reached(deadline) && !best_effort_wfe_or_timeout(deadline));
+
+    DelayStats.Yielding++;
+    DelayStats.YieldingUs += time_us_64() - start;
+}
+
+void DelayGetStats( DelayStats_t *stats )
+{
+    *stats = DelayStats;
+}
+
+void DelayResetStats( void )
+{
+    DelayStats = (DelayStats_t){ 0 };
 }
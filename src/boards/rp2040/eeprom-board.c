@@ -3,43 +3,761 @@
  *
  * SPDX-License-Identifier: BSD-3-Clause
  *
+ * The emulated EEPROM is a RAM image backed by a journal in flash. The
+ * journal spans EEPROM_SECTORS sectors split in two banks. A bank holds a
+ * header page, a snapshot of the image and a log of records, each carrying
+ * a changed range of the image. Flushes append records, when the log is
+ * full the image is compacted into a snapshot in the other bank. The header
+ * is programmed last, so a bank only becomes valid once its snapshot is
+ * complete, and the previous bank stays intact until then. The header
+ * carries CRCs of itself and of the snapshot, a bank failing them is
+ * skipped in favor of the older one.
+ *
+ * Flash is erased and programmed one sector or page at a time, and
+ * interrupts run between the operations. EepromMcuTryFlush does not start
+ * an erase when an RTC alarm is due before it could end.
+ *
+ * With EEPROM_XIP_READS the image is not mirrored in RAM. Reads are served
+ * from the XIP mapped flash through an index of the newest copy of every
+ * chunk, and changed chunks are held in a small overlay until the next
+ * flush.
  */
 
+#include <stddef.h>
 #include <string.h>
 
 #include "hardware/flash.h"
+#include "hardware/regs/m0plus.h"
+#include "hardware/sync.h"
+#include "pico/multicore.h"
 #include "pico/stdlib.h"
 
 #include "eeprom-board.h"
 #include "utilities.h"
+#include "pico/board-rp2040.h"
 
 #define EEPROM_SIZE (FLASH_SECTOR_SIZE)
-#define EEPROM_OFFSET (PICO_FLASH_SIZE_BYTES - EEPROM_SIZE)
-#define EEPROM_ADDRESS ((const uint8_t *)(XIP_BASE + EEPROM_OFFSET))
+#define EEPROM_CHUNKS (EEPROM_SIZE / EEPROM_CHUNK_SIZE)
+#define EEPROM_OFFSET (PICO_FLASH_SIZE_BYTES - EEPROM_SECTORS * FLASH_SECTOR_SIZE)
+#define EEPROM_BANK_SIZE (EEPROM_SECTORS / 2 * FLASH_SECTOR_SIZE)
+#define EEPROM_BANK_OFFSET(bank) (EEPROM_OFFSET + (bank) * EEPROM_BANK_SIZE)
+#define EEPROM_ADDRESS(offset) ((const uint8_t *)(XIP_BASE + (offset)))
+
+// Bank layout, offsets from the start of the bank
+#define EEPROM_SNAPSHOT_OFFSET (FLASH_PAGE_SIZE)
+#define EEPROM_LOG_OFFSET (EEPROM_SNAPSHOT_OFFSET + EEPROM_SIZE)
+
+// Before the journal, the image was stored as is in the last sector
+#define EEPROM_LEGACY_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+
+#define EEPROM_MAGIC 0x4a4d564e // "NVMJ"
+
+// Largest record, longer changed ranges are split
+#define EEPROM_RECORD_MAX_SIZE 256
+
+#define EEPROM_NVIC_ISER (*(io_rw_32 *)(PPB_BASE + M0PLUS_NVIC_ISER_OFFSET))
+#define EEPROM_NVIC_ICER (*(io_rw_32 *)(PPB_BASE + M0PLUS_NVIC_ICER_OFFSET))
+
+#if (EEPROM_SECTORS < 4) || (EEPROM_SECTORS % 2)
+#error "EEPROM_SECTORS must be even and at least 4"
+#endif
+
+#if EEPROM_XIP_READS && (EEPROM_BANK_SIZE > 0x10000)
+#error "EEPROM_XIP_READS supports banks of up to 64 KB"
+#endif
+
+typedef struct {
+  uint32_t Magic;
+  uint32_t Seq;       //! Incremented on every compaction, the newest bank wins
+  uint32_t ImageCrc;  //! Crc32 of the snapshot
+  uint32_t HeaderCrc; //! Crc32 of the fields above
+} EepromBankHeader_t;
+
+typedef struct {
+  uint32_t Crc;  //! Crc32 of Addr, Size and the data
+  uint16_t Addr; //! Image address of the data, 0xffff for free space
+  uint16_t Size; //! Data size, a multiple of EEPROM_CHUNK_SIZE
+} EepromRecord_t;
+
+// Set in Addr on the last record of a flush. Records of a flush that was
+// interrupted before it are dropped on replay, a flush lands as a whole.
+#define EEPROM_RECORD_COMMIT 0x8000
+
+#if EEPROM_XIP_READS
+// Bank offset of the newest copy of every chunk, 0 if it is erased
+static uint16_t eeprom_chunk_offset[EEPROM_CHUNKS];
+
+// Chunks changed since the last flush
+static uint16_t eeprom_overlay_chunk[EEPROM_OVERLAY_CHUNKS];
+static uint8_t eeprom_overlay_data[EEPROM_OVERLAY_CHUNKS][EEPROM_CHUNK_SIZE];
+static uint32_t eeprom_overlay_count = 0;
 
+static const uint8_t eeprom_erased_chunk[EEPROM_CHUNK_SIZE] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+#else
 static uint8_t eeprom_write_cache[EEPROM_SIZE];
 
-void EepromMcuInit() { memcpy(eeprom_write_cache, EEPROM_ADDRESS, sizeof(eeprom_write_cache)); }
+// One bit per chunk changed since the last flush
+static uint32_t eeprom_dirty[EEPROM_CHUNKS / 32];
+#endif
+
+// Set until the image has been journaled for the first time, it then comes
+// from the single sector layout
+static bool eeprom_legacy = false;
+
+// Bank the image is journaled to, -1 before the first flush
+static int eeprom_bank = -1;
+
+static uint32_t eeprom_seq = 0;
+
+// Offset of the free space in the active bank's log
+static uint32_t eeprom_log_head = EEPROM_BANK_SIZE;
+
+static EepromStats_t eeprom_stats;
+
+static EepromWriteFilter *eeprom_write_filter = NULL;
+
+// Set while the other core is locked out
+static bool eeprom_lockout = false;
+
+static uint64_t eeprom_masked_start;
+
+/*!
+ * \brief Makes flash safe to erase or program
+ *
+ * The other core is locked out when it runs the lockout handler. Instead of
+ * masking every interrupt, only those whose handlers may run from flash are
+ * disabled in the NVIC. The RTC alarm keeps firing from RAM and defers the
+ * timers to the end of the operation.
+ *
+ * \retval enabled NVIC enable mask to restore
+ */
+static uint32_t eeprom_flash_begin(void) {
+  eeprom_lockout = multicore_lockout_victim_is_initialized(get_core_num() ^ 1);
+
+  if (eeprom_lockout) {
+    multicore_lockout_start_blocking();
+  }
+
+  uint32_t status = save_and_disable_interrupts();
+  uint32_t enabled = EEPROM_NVIC_ISER;
+
+  EEPROM_NVIC_ICER = enabled & ~RtcDeferAlarms(true);
+
+  restore_interrupts(status);
+
+  eeprom_masked_start = time_us_64();
+
+  return enabled;
+}
+
+static void eeprom_flash_end(uint32_t enabled) {
+  uint32_t masked = time_us_64() - eeprom_masked_start;
+  uint32_t status = save_and_disable_interrupts();
+
+  RtcDeferAlarms(false);
+  EEPROM_NVIC_ISER = enabled;
+
+  restore_interrupts(status);
+
+  if (eeprom_lockout) {
+    multicore_lockout_end_blocking();
+  }
+
+  if (masked > eeprom_stats.MaxMaskedUs) {
+    eeprom_stats.MaxMaskedUs = masked;
+  }
+}
+
+static void eeprom_flash_erase(uint32_t offset) {
+  uint32_t enabled = eeprom_flash_begin();
+
+  flash_range_erase(offset, FLASH_SECTOR_SIZE);
+
+  eeprom_flash_end(enabled);
+
+  eeprom_stats.SectorErases++;
+}
+
+/*!
+ * \brief Checks whether an erase started now could hold back the RTC alarm
+ */
+static bool eeprom_erase_delays_alarm(void) {
+  uint64_t target = RtcGetAlarmTarget();
+
+  return (target != 0) && (target < (time_us_64() + EEPROM_ERASE_GUARD_US));
+}
+
+static void eeprom_flash_program(uint32_t offset, const uint8_t *page) {
+  uint32_t enabled = eeprom_flash_begin();
+
+  flash_range_program(offset, page, FLASH_PAGE_SIZE);
+
+  eeprom_flash_end(enabled);
+}
+
+#if EEPROM_XIP_READS
+static int eeprom_overlay_find(uint32_t chunk) {
+  for (uint32_t i = 0; i < eeprom_overlay_count; i++) {
+    if (eeprom_overlay_chunk[i] == chunk) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+static const uint8_t *eeprom_chunk_data(uint32_t chunk) {
+  int slot = eeprom_overlay_find(chunk);
+
+  if (slot >= 0) {
+    return eeprom_overlay_data[slot];
+  }
+  if (eeprom_chunk_offset[chunk] != 0) {
+    return EEPROM_ADDRESS(EEPROM_BANK_OFFSET(eeprom_bank) + eeprom_chunk_offset[chunk]);
+  }
+  if (eeprom_legacy) {
+    return EEPROM_ADDRESS(EEPROM_LEGACY_OFFSET + chunk * EEPROM_CHUNK_SIZE);
+  }
+
+  return eeprom_erased_chunk;
+}
+
+static inline bool eeprom_is_dirty(uint32_t chunk) { return eeprom_overlay_find(chunk) >= 0; }
+
+/*!
+ * \brief Number of overlay slots a write takes on top of those in use
+ */
+static uint32_t eeprom_overlay_needed(uint32_t addr, const uint8_t *data, uint32_t size) {
+  uint32_t needed = 0;
+
+  while (size > 0) {
+    uint32_t chunk = addr / EEPROM_CHUNK_SIZE;
+    uint32_t start = addr % EEPROM_CHUNK_SIZE;
+    uint32_t n = MIN(size, EEPROM_CHUNK_SIZE - start);
+
+    if (!eeprom_is_dirty(chunk) && (memcmp(eeprom_chunk_data(chunk) + start, data, n) != 0)) {
+      needed++;
+    }
+
+    addr += n;
+    data += n;
+    size -= n;
+  }
+
+  return needed;
+}
+
+static inline void eeprom_clear_dirty(void) { eeprom_overlay_count = 0; }
+
+/*!
+ * \brief Points the index at the snapshot of the active bank, or at erased
+ *        chunks without one
+ */
+static void eeprom_load_snapshot(void) {
+  for (uint32_t chunk = 0; chunk < EEPROM_CHUNKS; chunk++) {
+    eeprom_chunk_offset[chunk] = (eeprom_bank < 0) ? 0 : (EEPROM_SNAPSHOT_OFFSET + chunk * EEPROM_CHUNK_SIZE);
+  }
+}
+
+/*!
+ * \brief Points the index at a record programmed at offset of the active bank
+ */
+static void eeprom_load_record(uint32_t offset, const EepromRecord_t *record) {
+  uint32_t first = (record->Addr & ~EEPROM_RECORD_COMMIT) / EEPROM_CHUNK_SIZE;
+
+  for (uint32_t i = 0; i < (record->Size / EEPROM_CHUNK_SIZE); i++) {
+    eeprom_chunk_offset[first + i] = offset + sizeof(EepromRecord_t) + i * EEPROM_CHUNK_SIZE;
+  }
+}
+
+/*!
+ * \brief Flushes the overlay to make room for a write
+ *
+ * The guarded flush comes first. When it is refused, the overlay has no
+ * room to keep the changes pending next to the write. The flush is then
+ * forced and holds back the RTC alarm, because losing the write would be
+ * worse. NVM stores run while the MAC is idle, so that alarm is not one of
+ * its RX windows.
+ */
+static void eeprom_overlay_flush(void) {
+  if (EepromMcuTryFlush() != LMN_STATUS_OK) {
+    EepromMcuFlush();
+  }
+}
+
+/*!
+ * \brief Updates part of a chunk in the overlay
+ */
+static void eeprom_write_chunk(uint32_t chunk, uint32_t start, const uint8_t *data, uint32_t size) {
+  if (memcmp(eeprom_chunk_data(chunk) + start, data, size) == 0) {
+    return;
+  }
+
+  int slot = eeprom_overlay_find(chunk);
+
+  if (slot < 0) {
+    if (eeprom_overlay_count == EEPROM_OVERLAY_CHUNKS) {
+      // Only a write larger than the overlay gets here, it lands in flash
+      // in parts
+      eeprom_overlay_flush();
+    }
+
+    slot = eeprom_overlay_count;
+    memcpy(eeprom_overlay_data[slot], eeprom_chunk_data(chunk), EEPROM_CHUNK_SIZE);
+    eeprom_overlay_chunk[slot] = chunk;
+    eeprom_overlay_count++;
+  }
+
+  memcpy(eeprom_overlay_data[slot] + start, data, size);
+}
+#else
+static inline const uint8_t *eeprom_chunk_data(uint32_t chunk) {
+  return eeprom_write_cache + chunk * EEPROM_CHUNK_SIZE;
+}
+
+static inline bool eeprom_is_dirty(uint32_t chunk) { return eeprom_dirty[chunk / 32] & (1u << (chunk % 32)); }
+
+static inline void eeprom_clear_dirty(void) { memset(eeprom_dirty, 0, sizeof(eeprom_dirty)); }
+
+static void eeprom_load_snapshot(void) {
+  if (eeprom_bank < 0) {
+    memcpy(eeprom_write_cache, EEPROM_ADDRESS(EEPROM_LEGACY_OFFSET), EEPROM_SIZE);
+  } else {
+    memcpy(eeprom_write_cache, EEPROM_ADDRESS(EEPROM_BANK_OFFSET(eeprom_bank) + EEPROM_SNAPSHOT_OFFSET),
+           EEPROM_SIZE);
+  }
+}
+
+static void eeprom_load_record(uint32_t offset, const EepromRecord_t *record) {
+  memcpy(eeprom_write_cache + (record->Addr & ~EEPROM_RECORD_COMMIT), (const uint8_t *)(record + 1), record->Size);
+}
+
+static void eeprom_write_chunk(uint32_t chunk, uint32_t start, const uint8_t *data, uint32_t size) {
+  uint8_t *cache = eeprom_write_cache + chunk * EEPROM_CHUNK_SIZE + start;
+
+  if (memcmp(cache, data, size) == 0) {
+    return;
+  }
+
+  memcpy(cache, data, size);
+  eeprom_dirty[chunk / 32] |= 1u << (chunk % 32);
+}
+#endif
+
+static void eeprom_read(uint32_t addr, uint8_t *buffer, uint32_t size) {
+  while (size > 0) {
+    uint32_t chunk = addr / EEPROM_CHUNK_SIZE;
+    uint32_t start = addr % EEPROM_CHUNK_SIZE;
+    uint32_t n = MIN(size, EEPROM_CHUNK_SIZE - start);
+
+    memcpy(buffer, eeprom_chunk_data(chunk) + start, n);
+
+    addr += n;
+    buffer += n;
+    size -= n;
+  }
+}
+
+static inline const EepromBankHeader_t *eeprom_bank_header(int bank) {
+  return (const EepromBankHeader_t *)EEPROM_ADDRESS(EEPROM_BANK_OFFSET(bank));
+}
+
+static inline uint32_t eeprom_header_crc(const EepromBankHeader_t *header) {
+  return Crc32((uint8_t *)header, offsetof(EepromBankHeader_t, HeaderCrc));
+}
+
+/*!
+ * \brief Quick check of a bank, only its header is read
+ */
+static bool eeprom_bank_is_valid(int bank, uint32_t *seq) {
+  const EepromBankHeader_t *header = eeprom_bank_header(bank);
+
+  if ((header->Magic != EEPROM_MAGIC) || (header->HeaderCrc != eeprom_header_crc(header))) {
+    return false;
+  }
+
+  *seq = header->Seq;
+
+  return true;
+}
+
+/*!
+ * \brief Full check of a bank's snapshot, done on the bank being loaded
+ */
+static bool eeprom_bank_image_is_valid(int bank) {
+  const uint8_t *image = EEPROM_ADDRESS(EEPROM_BANK_OFFSET(bank) + EEPROM_SNAPSHOT_OFFSET);
+
+  return eeprom_bank_header(bank)->ImageCrc == Crc32((uint8_t *)image, EEPROM_SIZE);
+}
+
+static uint32_t eeprom_record_crc(const EepromRecord_t *record) {
+  return Crc32((uint8_t *)&record->Addr, sizeof(*record) - offsetof(EepromRecord_t, Addr) + record->Size);
+}
+
+static inline const EepromRecord_t *eeprom_record(uint32_t offset) {
+  return (const EepromRecord_t *)EEPROM_ADDRESS(EEPROM_BANK_OFFSET(eeprom_bank) + offset);
+}
+
+static bool eeprom_log_is_free(uint32_t offset) {
+  if ((offset + sizeof(EepromRecord_t)) > EEPROM_BANK_SIZE) {
+    return true;
+  }
+
+  const EepromRecord_t *record = eeprom_record(offset);
+
+  return (record->Crc == 0xffffffff) && (record->Addr == 0xffff) && (record->Size == 0xffff);
+}
+
+/*!
+ * \brief Applies the committed records of the active bank's log to the image
+ *
+ * \retval head Offset of the free space, the end of the bank if a torn
+ *              flush makes the rest of the log unusable
+ */
+static uint32_t eeprom_replay_log(void) {
+  uint32_t head = EEPROM_LOG_OFFSET;
+  uint32_t committed = EEPROM_LOG_OFFSET;
+
+  while (head + sizeof(EepromRecord_t) <= EEPROM_BANK_SIZE) {
+    const EepromRecord_t *record = eeprom_record(head);
+    uint32_t addr = record->Addr & ~EEPROM_RECORD_COMMIT;
+
+    if ((record->Crc == 0xffffffff) && (record->Addr == 0xffff) && (record->Size == 0xffff)) {
+      break;
+    }
+
+    if ((record->Size == 0) || (record->Size > EEPROM_RECORD_MAX_SIZE) || ((addr + record->Size) > EEPROM_SIZE) ||
+        ((head + sizeof(EepromRecord_t) + record->Size) > EEPROM_BANK_SIZE) ||
+        (record->Crc != eeprom_record_crc(record))) {
+      break;
+    }
+
+    head += sizeof(EepromRecord_t) + record->Size;
+
+    if (record->Addr & EEPROM_RECORD_COMMIT) {
+      committed = head;
+    }
+  }
+
+  for (uint32_t offset = EEPROM_LOG_OFFSET; offset < committed;) {
+    const EepromRecord_t *record = eeprom_record(offset);
+
+    eeprom_load_record(offset, record);
+
+    offset += sizeof(EepromRecord_t) + record->Size;
+  }
+
+  // Anything past the last commit is an interrupted flush, compact on the
+  // next flush instead of appending after it
+  if ((committed != head) || !eeprom_log_is_free(head)) {
+    return EEPROM_BANK_SIZE;
+  }
+
+  return committed;
+}
+
+/*!
+ * \brief Programs data at any offset, bytes around it in the page are left
+ *        as they are by programming them with 0xff
+ */
+static void eeprom_program(uint32_t offset, const uint8_t *data, uint32_t size) {
+  uint8_t page[FLASH_PAGE_SIZE];
+
+  while (size > 0) {
+    uint32_t page_offset = offset & ~(FLASH_PAGE_SIZE - 1);
+    uint32_t start = offset - page_offset;
+    uint32_t n = MIN(size, FLASH_PAGE_SIZE - start);
+
+    memset(page, 0xff, sizeof(page));
+    memcpy(page + start, data, n);
+
+    eeprom_flash_program(page_offset, page);
+
+    offset += n;
+    data += n;
+    size -= n;
+  }
+}
+
+/*!
+ * \brief Writes the image as snapshot of the other bank and switches to it
+ *
+ * The snapshot is streamed a page at a time from the current image.
+ *
+ * \param [IN] guard Give up before an erase that could hold back the RTC
+ *                   alarm, the active bank is left as it is
+ * \retval done      false if given up
+ */
+static bool eeprom_compact(bool guard) {
+  int bank = (eeprom_bank == 0) ? 1 : 0;
+  uint8_t page[FLASH_PAGE_SIZE];
+  uint32_t crc = Crc32Init();
+  EepromBankHeader_t header = {
+      .Magic = EEPROM_MAGIC,
+      .Seq = eeprom_seq + 1,
+  };
+
+  for (uint32_t offset = 0; offset < EEPROM_BANK_SIZE; offset += FLASH_SECTOR_SIZE) {
+    // Checked before every sector, a timer that fired after the previous
+    // one may have armed the alarm again
+    if (guard && eeprom_erase_delays_alarm()) {
+      return false;
+    }
+
+    eeprom_flash_erase(EEPROM_BANK_OFFSET(bank) + offset);
+  }
+
+  for (uint32_t addr = 0; addr < EEPROM_SIZE; addr += FLASH_PAGE_SIZE) {
+    eeprom_read(addr, page, FLASH_PAGE_SIZE);
+    crc = Crc32Update(crc, page, FLASH_PAGE_SIZE);
+    eeprom_flash_program(EEPROM_BANK_OFFSET(bank) + EEPROM_SNAPSHOT_OFFSET + addr, page);
+  }
+
+  header.ImageCrc = Crc32Finalize(crc);
+  header.HeaderCrc = eeprom_header_crc(&header);
+  eeprom_program(EEPROM_BANK_OFFSET(bank), (const uint8_t *)&header, sizeof(header));
+
+  eeprom_bank = bank;
+  eeprom_seq = header.Seq;
+  eeprom_log_head = EEPROM_LOG_OFFSET;
+  eeprom_legacy = false;
+
+#if EEPROM_XIP_READS
+  eeprom_load_snapshot();
+#endif
+
+  eeprom_stats.Compactions++;
+
+  return true;
+}
+
+static void eeprom_append(uint16_t addr, uint16_t size, bool commit) {
+  uint8_t buffer[sizeof(EepromRecord_t) + EEPROM_RECORD_MAX_SIZE];
+  EepromRecord_t *record = (EepromRecord_t *)buffer;
+
+  record->Addr = addr | (commit ? EEPROM_RECORD_COMMIT : 0);
+  record->Size = size;
+  eeprom_read(addr, buffer + sizeof(EepromRecord_t), size);
+  record->Crc = eeprom_record_crc(record);
+
+  eeprom_program(EEPROM_BANK_OFFSET(eeprom_bank) + eeprom_log_head, buffer, sizeof(EepromRecord_t) + size);
+
+#if EEPROM_XIP_READS
+  eeprom_load_record(eeprom_log_head, record);
+#endif
+
+  eeprom_log_head += sizeof(EepromRecord_t) + size;
+
+  eeprom_stats.Records++;
+  eeprom_stats.RecordBytes += size;
+}
+
+/*!
+ * \brief Calls fn for every run of dirty chunks, split to the record size
+ */
+static void eeprom_for_each_dirty_run(void (*fn)(uint16_t addr, uint16_t size, void *context), void *context) {
+  uint32_t chunk = 0;
+
+  while (chunk < EEPROM_CHUNKS) {
+    if (!eeprom_is_dirty(chunk)) {
+      chunk++;
+      continue;
+    }
+
+    uint32_t first = chunk;
+
+    while ((chunk < EEPROM_CHUNKS) && eeprom_is_dirty(chunk) &&
+           ((chunk - first) < (EEPROM_RECORD_MAX_SIZE / EEPROM_CHUNK_SIZE))) {
+      chunk++;
+    }
+
+    fn(first * EEPROM_CHUNK_SIZE, (chunk - first) * EEPROM_CHUNK_SIZE, context);
+  }
+}
+
+static void eeprom_add_record_size(uint16_t addr, uint16_t size, void *context) {
+  *(uint32_t *)context += sizeof(EepromRecord_t) + size;
+}
+
+static void eeprom_append_run(uint16_t addr, uint16_t size, void *context) {
+  uint32_t end = *(uint32_t *)context;
+
+  eeprom_append(addr, size, (eeprom_log_head + sizeof(EepromRecord_t) + size) == end);
+}
+
+void EepromMcuInit() {
+  uint32_t seq[2];
+  bool valid[2] = {eeprom_bank_is_valid(0, &seq[0]), eeprom_bank_is_valid(1, &seq[1])};
+
+  eeprom_clear_dirty();
+  eeprom_legacy = false;
+
+  // Newest bank first, the older one is intact until the next compaction
+  int order[2] = {0, 1};
+
+  if (valid[0] && valid[1] && ((int32_t)(seq[1] - seq[0]) > 0)) {
+    order[0] = 1;
+    order[1] = 0;
+  }
+
+  // Only a newer bank whose snapshot is torn makes loading the other one a
+  // fallback, not a bank whose header was never written
+  bool torn = false;
+
+  for (int i = 0; i < 2; i++) {
+    int bank = order[i];
+
+    if (!valid[bank]) {
+      continue;
+    }
+
+    if (!eeprom_bank_image_is_valid(bank)) {
+      torn = true;
+      continue;
+    }
+
+    if (torn) {
+      eeprom_stats.Fallbacks++;
+    }
+
+    eeprom_bank = bank;
+    eeprom_seq = seq[bank];
+
+    eeprom_load_snapshot();
+    eeprom_log_head = eeprom_replay_log();
+    return;
+  }
+
+  eeprom_bank = -1;
+
+  if (valid[0] || valid[1]) {
+    // Journal present but no snapshot survived, start over from erased NVM,
+    // the LoRaMac NVM groups then fail their CRC checks and are reset
+    eeprom_seq = seq[valid[order[0]] ? order[0] : order[1]];
+
+#if EEPROM_XIP_READS
+    eeprom_load_snapshot();
+#else
+    memset(eeprom_write_cache, 0xff, EEPROM_SIZE);
+#endif
+    return;
+  }
+
+  // No journal yet, start from the image of the single sector layout. The
+  // first compaction goes to bank 0, which does not overlap it.
+  eeprom_seq = 0;
+
+  const uint8_t *legacy = EEPROM_ADDRESS(EEPROM_LEGACY_OFFSET);
+
+  for (uint32_t i = 0; i < EEPROM_SIZE; i++) {
+    if (legacy[i] != 0xff) {
+      eeprom_legacy = true;
+      break;
+    }
+  }
+
+  eeprom_load_snapshot();
+
+  if (eeprom_legacy) {
+    // Migrate right away, the legacy sector belongs to bank 1. A refused
+    // migration stays pending until the next flush.
+    EepromMcuTryFlush();
+  }
+}
 
 uint8_t EepromMcuReadBuffer(uint16_t addr, uint8_t *buffer, uint16_t size) {
-  memcpy(buffer, eeprom_write_cache + addr, size);
+  if ((addr + size) > EEPROM_SIZE) {
+    return LMN_STATUS_ERROR;
+  }
+
+  eeprom_read(addr, buffer, size);
 
   return LMN_STATUS_OK;
 }
 
 uint8_t EepromMcuWriteBuffer(uint16_t addr, uint8_t *buffer, uint16_t size) {
-  memcpy(eeprom_write_cache + addr, buffer, size);
+  const uint8_t *data = buffer;
+
+  if ((addr + size) > EEPROM_SIZE) {
+    return LMN_STATUS_ERROR;
+  }
+
+  if (eeprom_write_filter != NULL) {
+    data = eeprom_write_filter(addr, buffer, size);
+  }
+
+#if EEPROM_XIP_READS
+  // Flush the earlier changes when the write does not fit next to them, so
+  // that it lands in flash as a whole
+  if ((eeprom_overlay_count + eeprom_overlay_needed(addr, data, size)) > EEPROM_OVERLAY_CHUNKS) {
+    eeprom_overlay_flush();
+  }
+#endif
+
+  // Only chunks whose content changes are journaled
+  while (size > 0) {
+    uint32_t chunk = addr / EEPROM_CHUNK_SIZE;
+    uint32_t start = addr % EEPROM_CHUNK_SIZE;
+    uint32_t n = MIN(size, EEPROM_CHUNK_SIZE - start);
+
+    eeprom_write_chunk(chunk, start, data, n);
+
+    addr += n;
+    data += n;
+    size -= n;
+  }
 
   return LMN_STATUS_OK;
 }
 
-uint8_t EepromMcuFlush() {
-  uint32_t mask;
+void EepromSetWriteFilter(EepromWriteFilter *filter) { eeprom_write_filter = filter; }
 
-  BoardCriticalSectionBegin(&mask);
+/*!
+ * \brief Flushes the changes, see EepromMcuFlush and EepromMcuTryFlush
+ */
+static uint8_t eeprom_flush(bool guard) {
+  uint32_t needed = 0;
+
+  eeprom_for_each_dirty_run(eeprom_add_record_size, &needed);
+
+  if ((needed == 0) && !eeprom_legacy) {
+    return LMN_STATUS_OK;
+  }
+
+  uint64_t start = time_us_64();
+
+  if ((eeprom_bank < 0) || ((eeprom_log_head + needed) > EEPROM_BANK_SIZE)) {
+    // The snapshot holds the changes as well
+    if (!eeprom_compact(guard)) {
+      eeprom_stats.Deferrals++;
+      eeprom_stats.BusyUs += time_us_64() - start;
+      return LMN_STATUS_ERROR;
+    }
+  } else {
+    uint32_t end = eeprom_log_head + needed;
+
+    eeprom_for_each_dirty_run(eeprom_append_run, &end);
+  }
+
+  eeprom_clear_dirty();
 
-  flash_range_erase(EEPROM_OFFSET, sizeof(eeprom_write_cache));
-  flash_range_program(EEPROM_OFFSET, eeprom_write_cache, sizeof(eeprom_write_cache));
+  uint32_t elapsed = time_us_64() - start;
 
-  BoardCriticalSectionEnd(&mask);
+  eeprom_stats.Flushes++;
+  eeprom_stats.BusyUs += elapsed;
+  if (elapsed > eeprom_stats.MaxFlushUs) {
+    eeprom_stats.MaxFlushUs = elapsed;
+  }
+
+  return LMN_STATUS_OK;
 }
+
+uint8_t EepromMcuFlush() { return eeprom_flush(false); }
+
+uint8_t EepromMcuTryFlush() { return eeprom_flush(true); }
+
+void EepromGetStats(EepromStats_t *stats) { *stats = eeprom_stats; }
+
+void EepromResetStats(void) { memset(&eeprom_stats, 0, sizeof(eeprom_stats)); }
@@ -6,9 +6,63 @@
  */
 
 #include "hardware/gpio.h"
+#include "hardware/irq.h"
 
 #include "gpio-board.h"
 
+/*!
+ * Per pin interrupt dispatch table, all pins share the single bank 0 callback
+ */
+static struct {
+  Gpio_t *Obj;
+  GpioIrqHandler *Handler;
+  IrqPriorities Priority;
+} GpioIrqTable[NUM_BANK0_GPIOS];
+
+static void GpioMcuIrqCallback(uint gpio, uint32_t events) {
+  if ((gpio >= NUM_BANK0_GPIOS) || (GpioIrqTable[gpio].Handler == NULL)) {
+    return;
+  }
+
+  GpioIrqTable[gpio].Handler(GpioIrqTable[gpio].Obj->Context);
+}
+
+static uint8_t GpioMcuNvicPriority(IrqPriorities irqPriority) {
+  switch (irqPriority) {
+  case IRQ_VERY_HIGH_PRIORITY:
+    return PICO_HIGHEST_IRQ_PRIORITY;
+  case IRQ_HIGH_PRIORITY:
+    return 0x40;
+  case IRQ_MEDIUM_PRIORITY:
+    return PICO_DEFAULT_IRQ_PRIORITY;
+  case IRQ_LOW_PRIORITY:
+  case IRQ_VERY_LOW_PRIORITY:
+  default:
+    return PICO_LOWEST_IRQ_PRIORITY;
+  }
+}
+
+/*!
+ * \brief Sets the bank 0 IRQ priority to the most urgent of the armed pins
+ *
+ * The RP2040 has a single NVIC line for all bank 0 GPIOs.
+ */
+static void GpioMcuUpdateIrqPriority(void) {
+  uint8_t priority = PICO_LOWEST_IRQ_PRIORITY;
+
+  for (uint i = 0; i < NUM_BANK0_GPIOS; i++) {
+    if (GpioIrqTable[i].Handler != NULL) {
+      uint8_t pinPriority = GpioMcuNvicPriority(GpioIrqTable[i].Priority);
+
+      if (pinPriority < priority) {
+        priority = pinPriority;
+      }
+    }
+  }
+
+  irq_set_priority(IO_IRQ_BANK0, priority);
+}
+
 void GpioMcuInit(Gpio_t *obj, PinNames pin, PinModes mode, PinConfigs config, PinTypes type,
                  uint32_t value) {
   obj->pin = pin;
@@ -46,9 +100,53 @@ uint32_t GpioMcuRead(Gpio_t *obj) { return gpio_get(obj->pin); }
 
 void GpioMcuSetInterrupt(Gpio_t *obj, IrqModes irqMode, IrqPriorities irqPriority,
                          GpioIrqHandler *irqHandler) {
-  // gpio_set_irq_enabled_with_callback(obj->pin, GPIO_IRQ_EDGE_RISE, true, irqHandler);
+  uint32_t events;
+
+  if ((obj->pin == NC) || (obj->pin >= NUM_BANK0_GPIOS)) {
+    return;
+  }
+
+  switch (irqMode) {
+  case IRQ_RISING_EDGE:
+    events = GPIO_IRQ_EDGE_RISE;
+    break;
+  case IRQ_FALLING_EDGE:
+    events = GPIO_IRQ_EDGE_FALL;
+    break;
+  case IRQ_RISING_FALLING_EDGE:
+    events = GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL;
+    break;
+  default:
+    GpioMcuRemoveInterrupt(obj);
+    return;
+  }
+
+  if (irqHandler == NULL) {
+    GpioMcuRemoveInterrupt(obj);
+    return;
+  }
+
+  // Disarm any previous edge selection before switching modes
+  gpio_set_irq_enabled(obj->pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, false);
+
+  GpioIrqTable[obj->pin].Obj = obj;
+  GpioIrqTable[obj->pin].Handler = irqHandler;
+  GpioIrqTable[obj->pin].Priority = irqPriority;
+
+  GpioMcuUpdateIrqPriority();
+
+  gpio_set_irq_enabled_with_callback(obj->pin, events, true, GpioMcuIrqCallback);
 }
 
 void GpioMcuRemoveInterrupt(Gpio_t *obj) {
-  // gpio_set_irq_enabled(obj->pin, GPIO_IRQ_EDGE_RISE, false);
+  if ((obj->pin == NC) || (obj->pin >= NUM_BANK0_GPIOS)) {
+    return;
+  }
+
+  gpio_set_irq_enabled(obj->pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, false);
+
+  GpioIrqTable[obj->pin].Handler = NULL;
+  GpioIrqTable[obj->pin].Obj = NULL;
+
+  GpioMcuUpdateIrqPriority();
 }
\ No newline at end of file
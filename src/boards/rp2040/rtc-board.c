@@ -7,23 +7,131 @@
 
 #include "pico/time.h"
 #include "pico/stdlib.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
 
 #include "rtc-board.h"
+#include "pico/board-rp2040.h"
 
-static alarm_pool_t* rtc_alarm_pool = NULL;
 static absolute_time_t rtc_timer_context;
-static alarm_id_t last_rtc_alarm_id = -1;
+
+/*!
+ * Hardware alarm driven directly, without an alarm pool in between
+ */
+static int rtc_alarm_num = -1;
+
+/*!
+ * Time the pending alarm is due [us since boot], 0 when no alarm is armed
+ */
+static volatile uint64_t rtc_alarm_target = 0;
+
+static RtcAlarmStats_t rtc_alarm_stats;
+
+/*!
+ * Set while flash is not accessible, alarms raised meanwhile are deferred
+ */
+static volatile bool rtc_alarm_deferring = false;
+
+static volatile bool rtc_alarm_deferred = false;
+
+/*!
+ * Backup registers, SysTime keeps the offset from the calendar time to the
+ * network time here. RAM only, the offset is lost on reset.
+ */
+static uint32_t rtc_bkup[2];
+
+/*!
+ * Length of a timer tick [us]
+ *
+ * Ticks are milliseconds counted from the 64-bit microsecond timer, so every
+ * tick value, context and elapsed time is taken from the same epoch and the
+ * 32-bit tick wraps consistently, once every 49.7 days. Intervals handed to
+ * the MAC never come near that, while a microsecond tick wrapped every 71
+ * minutes.
+ */
+#define RTC_TICK_US 1000
+
+static inline uint32_t RtcUs2Tick( uint64_t us )
+{
+    return (uint32_t)(us / RTC_TICK_US);
+}
+
+static void RtcAlarmArm( uint64_t target )
+{
+    uint32_t mask = 1u << rtc_alarm_num;
+
+    // The compare register only holds the low 32 bits, a target further
+    // away than that fires early and is re-armed from the IRQ handler
+    timer_hw->alarm[rtc_alarm_num] = (uint32_t)target;
+
+    // The target may have passed before the alarm was armed
+    if (time_us_64() >= target) {
+        hw_set_bits(&timer_hw->intf, mask);
+    }
+}
+
+/*!
+ * In RAM, so the alarm IRQ may stay enabled while flash is erased or
+ * programmed. Only the deferral path runs then, it touches nothing in
+ * flash. The alarm fires once flash is back, TimerIrqHandler and the
+ * timer callbacks run from flash.
+ */
+static void __not_in_flash_func(RtcAlarmIrqHandler)( void )
+{
+    uint32_t mask = 1u << rtc_alarm_num;
+
+    hw_clear_bits(&timer_hw->intf, mask);
+    timer_hw->intr = mask;
+
+    if (rtc_alarm_deferring) {
+        rtc_alarm_deferred = true;
+        return;
+    }
+
+    uint64_t now = time_us_64();
+    uint64_t target = rtc_alarm_target;
+
+    if (target == 0) {
+        // Stopped after the IRQ was raised
+        return;
+    }
+
+    if (now < target) {
+        RtcAlarmArm(target);
+        return;
+    }
+
+    rtc_alarm_target = 0;
+
+    uint32_t latency = now - target;
+
+    rtc_alarm_stats.Fired++;
+    rtc_alarm_stats.LastLatencyUs = latency;
+    rtc_alarm_stats.TotalLatencyUs += latency;
+    if (latency > rtc_alarm_stats.MaxLatencyUs) {
+        rtc_alarm_stats.MaxLatencyUs = latency;
+    }
+
+    TimerIrqHandler( );
+}
 
 void RtcInit( void )
 {
-    rtc_alarm_pool = alarm_pool_create(2, 16);
+    if (rtc_alarm_num < 0) {
+        rtc_alarm_num = hardware_alarm_claim_unused(true);
+
+        irq_set_exclusive_handler(TIMER_IRQ_0 + rtc_alarm_num, RtcAlarmIrqHandler);
+        hw_set_bits(&timer_hw->inte, 1u << rtc_alarm_num);
+        irq_set_enabled(TIMER_IRQ_0 + rtc_alarm_num, true);
+    }
 
     RtcSetTimerContext();
 }
 
 uint32_t RtcGetCalendarTime( uint16_t *milliseconds )
 {
-    uint32_t now = to_ms_since_boot(get_absolute_time());
+    uint64_t now = time_us_64() / 1000;
 
     *milliseconds = (now % 1000);
 
@@ -32,31 +140,31 @@ uint32_t RtcGetCalendarTime( uint16_t *milliseconds )
 
 void RtcBkupRead( uint32_t *data0, uint32_t *data1 )
 {
-    *data0 = 0;
-    *data1 = 0;
+    uint32_t mask = save_and_disable_interrupts();
+
+    *data0 = rtc_bkup[0];
+    *data1 = rtc_bkup[1];
+
+    restore_interrupts(mask);
 }
 
 uint32_t RtcGetTimerElapsedTime( void )
 {
     int64_t delta = absolute_time_diff_us(rtc_timer_context, get_absolute_time());
 
-    return delta;
+    return RtcUs2Tick(delta);
 }
 
 uint32_t RtcSetTimerContext( void )
 {
     rtc_timer_context = get_absolute_time();
 
-    uint64_t ticks = to_us_since_boot(rtc_timer_context);
-
-    return ticks;
+    return RtcUs2Tick(to_us_since_boot(rtc_timer_context));
 }
 
 uint32_t RtcGetTimerContext( void )
 {
-    uint64_t ticks = to_us_since_boot(rtc_timer_context);
-
-    return ticks;
+    return RtcUs2Tick(to_us_since_boot(rtc_timer_context));
 }
 
 uint32_t RtcGetMinimumTimeout( void )
@@ -64,47 +172,99 @@ uint32_t RtcGetMinimumTimeout( void )
     return 1;
 }
 
-static int64_t alarm_callback(alarm_id_t id, void *user_data) {
-    TimerIrqHandler( );
-
-    return 0;
+void RtcSetAlarm( uint32_t timeout )
+{
+    RtcSetAlarmUs(to_us_since_boot(delayed_by_us(rtc_timer_context, (uint64_t)timeout * RTC_TICK_US)));
 }
 
-void RtcSetAlarm( uint32_t timeout )
+void RtcSetAlarmUs( uint64_t target )
 {
-    if (last_rtc_alarm_id > -1) {
-        alarm_pool_cancel_alarm(rtc_alarm_pool, last_rtc_alarm_id);
-    }
+    uint32_t status = save_and_disable_interrupts();
+
+    // Reprogramming the compare register reschedules the alarm in place
+    rtc_alarm_target = target;
+    RtcAlarmArm(rtc_alarm_target);
 
-    last_rtc_alarm_id = alarm_pool_add_alarm_at(rtc_alarm_pool, delayed_by_us(rtc_timer_context, timeout), alarm_callback, NULL, true);
+    rtc_alarm_stats.Scheduled++;
+
+    restore_interrupts(status);
 }
 
 void RtcStopAlarm( void )
 {
-    if (last_rtc_alarm_id > -1) {
-        alarm_pool_cancel_alarm(rtc_alarm_pool, last_rtc_alarm_id);
+    uint32_t mask = 1u << rtc_alarm_num;
+    uint32_t status = save_and_disable_interrupts();
+
+    rtc_alarm_target = 0;
+
+    timer_hw->armed = mask;
+    hw_clear_bits(&timer_hw->intf, mask);
+    timer_hw->intr = mask;
+
+    restore_interrupts(status);
+}
+
+uint32_t RtcDeferAlarms( bool defer )
+{
+    if (rtc_alarm_num < 0) {
+        return 0;
     }
+
+    rtc_alarm_deferring = defer;
+
+    if (!defer && rtc_alarm_deferred) {
+        rtc_alarm_deferred = false;
+
+        // Raise the alarm again, now that the handler may run to completion
+        hw_set_bits(&timer_hw->intf, 1u << rtc_alarm_num);
+    }
+
+    return 1u << (TIMER_IRQ_0 + rtc_alarm_num);
+}
+
+uint64_t RtcGetAlarmTarget( void )
+{
+    return rtc_alarm_target;
+}
+
+uint RtcGetAlarmIrq( void )
+{
+    return TIMER_IRQ_0 + rtc_alarm_num;
+}
+
+void RtcGetAlarmStats( RtcAlarmStats_t *stats )
+{
+    *stats = rtc_alarm_stats;
+}
+
+void RtcResetAlarmStats( void )
+{
+    rtc_alarm_stats = (RtcAlarmStats_t){ 0 };
 }
 
 uint32_t RtcMs2Tick( TimerTime_t milliseconds )
 {
-    return milliseconds * 1000;
+    return milliseconds;
 }
 
 uint32_t RtcGetTimerValue( void )
 {
-    uint64_t now = to_us_since_boot(get_absolute_time());
-
-    return now;
+    return RtcUs2Tick(time_us_64());
 }
 
 TimerTime_t RtcTick2Ms( uint32_t tick )
 {
-    return us_to_ms(tick);
+    return tick;
 }
 
 void RtcBkupWrite( uint32_t data0, uint32_t data1 )
 {
+    uint32_t mask = save_and_disable_interrupts();
+
+    rtc_bkup[0] = data0;
+    rtc_bkup[1] = data1;
+
+    restore_interrupts(mask);
 }
 
 void RtcProcess( void )
@@ -6,13 +6,57 @@
  */
 
 #include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
 #include "hardware/spi.h"
+#include "hardware/sync.h"
 
+#include "sx126x-spi.pio.h"
+
+#include "gpio.h"
 #include "spi-board.h"
+#include "pico/board-rp2040.h"
+
+static SpiStats_t SpiStats;
+
+/*!
+ * State of the DMA path, a single transfer is in flight at a time
+ */
+static struct {
+    int TxChannel;
+    int RxChannel;
+    Spi_t *volatile Owner;
+    SpiDmaCallback *Callback;
+    void *Context;
+} SpiDma = { .TxChannel = -1, .RxChannel = -1 };
+
+/*!
+ * Source of the dummy bytes clocked out during reads, and sink of the
+ * bytes clocked in during writes
+ */
+static uint8_t SpiDmaDummy;
+
+/*!
+ * State of the PIO engine, it serves a single SPI object
+ */
+static struct {
+    Spi_t *Obj;
+    PIO Pio;
+    uint Sm;
+    uint Offset;
+    bool WaitBusy;
+} SpiPio;
+
+static inline spi_inst_t *SpiGetInst( Spi_t *obj )
+{
+    return (obj->SpiId == 0) ? spi0 : spi1;
+}
 
 void SpiInit( Spi_t *obj, SpiId_t spiId, PinNames mosi, PinNames miso, PinNames sclk, PinNames nss )
 {
-    spi_init((spiId == 0) ? spi0 : spi1, 10 * 1000 * 1000);
+    spi_init((spiId == 0) ? spi0 : spi1, SPI_DEFAULT_FREQUENCY);
     spi_set_format((spiId == 0) ? spi0 : spi1, 8, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
     gpio_set_function(mosi, GPIO_FUNC_SPI);
     gpio_set_function(miso, GPIO_FUNC_SPI);
@@ -21,12 +65,320 @@ void SpiInit( Spi_t *obj, SpiId_t spiId, PinNames mosi, PinNames miso, PinNames
     obj->SpiId = spiId;
 }
 
+void SpiFrequency( Spi_t *obj, uint32_t hz )
+{
+    if (SpiIsPio(obj)) {
+        // The state machine takes four cycles per SCK period
+        pio_sm_set_clkdiv(SpiPio.Pio, SpiPio.Sm, (float)clock_get_hz(clk_sys) / (4 * hz));
+        return;
+    }
+
+    SpiWaitIdle(obj);
+
+    spi_set_baudrate(SpiGetInst(obj), hz);
+}
+
 uint16_t SpiInOut( Spi_t *obj, uint16_t outData )
 {
     const uint8_t outDataB = (outData & 0xff);
     uint8_t inDataB = 0x00;
 
-    spi_write_read_blocking((obj->SpiId == 0) ? spi0 : spi1, &outDataB, &inDataB, 1);
+    spi_write_read_blocking(SpiGetInst(obj), &outDataB, &inDataB, 1);
+
+    SpiStats.Calls++;
+    SpiStats.Bytes++;
 
     return inDataB;
 }
+
+void SpiOut( Spi_t *obj, const uint8_t *outData, uint16_t size )
+{
+    if (size == 0) {
+        return;
+    }
+
+    spi_write_blocking(SpiGetInst(obj), outData, size);
+
+    SpiStats.Calls++;
+    SpiStats.Bytes += size;
+}
+
+void SpiIn( Spi_t *obj, uint8_t *inData, uint16_t size )
+{
+    if (size == 0) {
+        return;
+    }
+
+    spi_read_blocking(SpiGetInst(obj), 0x00, inData, size);
+
+    SpiStats.Calls++;
+    SpiStats.Bytes += size;
+}
+
+void SpiTransfer( Spi_t *obj, const uint8_t *outData, uint8_t *inData, uint16_t size )
+{
+    if (size == 0) {
+        return;
+    }
+
+    spi_write_read_blocking(SpiGetInst(obj), outData, inData, size);
+
+    SpiStats.Calls++;
+    SpiStats.Bytes += size;
+}
+
+static void SpiDmaComplete( void )
+{
+    dma_channel_acknowledge_irq0(SpiDma.RxChannel);
+
+    // The RX channel finishes after the last byte has been shifted in, so the
+    // bus is idle and NSS can be released
+    Spi_t *obj = SpiDma.Owner;
+
+    GpioWrite(&obj->Nss, 1);
+
+    SpiDma.Owner = NULL;
+
+    if (SpiDma.Callback != NULL) {
+        SpiDma.Callback(SpiDma.Context);
+    }
+
+    __sev();
+}
+
+static void SpiDmaIrqHandler( void )
+{
+    if ((SpiDma.RxChannel < 0) || !dma_channel_get_irq0_status(SpiDma.RxChannel)) {
+        return;
+    }
+
+    SpiDmaComplete();
+}
+
+static void SpiDmaInit( void )
+{
+    if (SpiDma.RxChannel >= 0) {
+        return;
+    }
+
+    SpiDma.TxChannel = dma_claim_unused_channel(true);
+    SpiDma.RxChannel = dma_claim_unused_channel(true);
+
+    dma_channel_set_irq0_enabled(SpiDma.RxChannel, true);
+    irq_add_shared_handler(DMA_IRQ_0, SpiDmaIrqHandler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
+}
+
+static void SpiDmaStart( Spi_t *obj, const uint8_t *outData, uint8_t *inData, uint16_t size, SpiDmaCallback *callback, void *context )
+{
+    spi_inst_t *spi = SpiGetInst(obj);
+
+    SpiDmaInit();
+
+    SpiDma.Owner = obj;
+    SpiDma.Callback = callback;
+    SpiDma.Context = context;
+
+    dma_channel_config txConfig = dma_channel_get_default_config(SpiDma.TxChannel);
+    channel_config_set_transfer_data_size(&txConfig, DMA_SIZE_8);
+    channel_config_set_dreq(&txConfig, spi_get_dreq(spi, true));
+    channel_config_set_read_increment(&txConfig, outData != NULL);
+    channel_config_set_write_increment(&txConfig, false);
+    dma_channel_configure(SpiDma.TxChannel, &txConfig, &spi_get_hw(spi)->dr,
+                          (outData != NULL) ? outData : &SpiDmaDummy, size, false);
+
+    dma_channel_config rxConfig = dma_channel_get_default_config(SpiDma.RxChannel);
+    channel_config_set_transfer_data_size(&rxConfig, DMA_SIZE_8);
+    channel_config_set_dreq(&rxConfig, spi_get_dreq(spi, false));
+    channel_config_set_read_increment(&rxConfig, false);
+    channel_config_set_write_increment(&rxConfig, inData != NULL);
+    dma_channel_configure(SpiDma.RxChannel, &rxConfig, (inData != NULL) ? inData : &SpiDmaDummy,
+                          &spi_get_hw(spi)->dr, size, false);
+
+    SpiDmaDummy = 0x00;
+
+    SpiStats.Calls++;
+    SpiStats.Bytes += size;
+
+    dma_start_channel_mask((1u << SpiDma.TxChannel) | (1u << SpiDma.RxChannel));
+}
+
+void SpiOutAsync( Spi_t *obj, const uint8_t *outData, uint16_t size, SpiDmaCallback *callback, void *context )
+{
+    if (size < SPI_DMA_MIN_SIZE) {
+        SpiOut(obj, outData, size);
+
+        GpioWrite(&obj->Nss, 1);
+
+        if (callback != NULL) {
+            callback(context);
+        }
+        return;
+    }
+
+    SpiDmaStart(obj, outData, NULL, size, callback, context);
+}
+
+void SpiInAsync( Spi_t *obj, uint8_t *inData, uint16_t size, SpiDmaCallback *callback, void *context )
+{
+    if (size < SPI_DMA_MIN_SIZE) {
+        SpiIn(obj, inData, size);
+
+        GpioWrite(&obj->Nss, 1);
+
+        if (callback != NULL) {
+            callback(context);
+        }
+        return;
+    }
+
+    SpiDmaStart(obj, NULL, inData, size, callback, context);
+}
+
+bool SpiIsBusy( Spi_t *obj )
+{
+    return SpiDma.Owner == obj;
+}
+
+void SpiWaitIdle( Spi_t *obj )
+{
+    // Nothing in flight for this object, or the DMA channels are not even
+    // claimed yet
+    if ((SpiDma.RxChannel < 0) || (SpiDma.Owner != obj)) {
+        return;
+    }
+
+    uint32_t status = save_and_disable_interrupts();
+
+    restore_interrupts(status);
+
+    // WFE is only woken by the DMA IRQ from thread mode with interrupts enabled
+    if ((__get_current_exception() == 0) && ((status & 1) == 0)) {
+        while (SpiDma.Owner == obj) {
+            __wfe();
+        }
+        return;
+    }
+
+    // The DMA IRQ may be masked here, so complete the transfer in place
+    // instead of waiting for the handler
+    while (dma_channel_is_busy(SpiDma.RxChannel)) {
+        tight_loop_contents();
+    }
+
+    status = save_and_disable_interrupts();
+
+    if (SpiDma.Owner == obj) {
+        SpiDmaComplete();
+    }
+
+    restore_interrupts(status);
+}
+
+void SpiGetStats( SpiStats_t *stats )
+{
+    *stats = SpiStats;
+}
+
+void SpiResetStats( void )
+{
+    SpiStats.Calls = 0;
+    SpiStats.Bytes = 0;
+}
+
+void SpiPioInit( Spi_t *obj, PIO pio, PinNames mosi, PinNames miso, PinNames sclk, PinNames nss, PinNames busy )
+{
+    // Leave the hardware SPI block to other peripherals
+    SpiPio.Pio = pio;
+    SpiPio.Sm = pio_claim_unused_sm(pio, true);
+    SpiPio.Offset = pio_add_program(pio, &sx126x_spi_program);
+    SpiPio.WaitBusy = (busy != NC);
+
+    // Without a BUSY pin the wait is never requested, NSS doubles as jmp pin
+    sx126x_spi_program_init(pio, SpiPio.Sm, SpiPio.Offset, SPI_DEFAULT_FREQUENCY, mosi, miso, sclk, nss,
+                            SpiPio.WaitBusy ? busy : nss);
+
+    SpiPio.Obj = obj;
+}
+
+bool SpiIsPio( Spi_t *obj )
+{
+    return SpiPio.Obj == obj;
+}
+
+bool SpiPioWaitsOnBusy( Spi_t *obj )
+{
+    return SpiIsPio(obj) && SpiPio.WaitBusy;
+}
+
+static void SpiPioRestart( void )
+{
+    PIO pio = SpiPio.Pio;
+    uint sm = SpiPio.Sm;
+
+    pio_sm_set_enabled(pio, sm, false);
+    pio_sm_clear_fifos(pio, sm);
+    pio_sm_restart(pio, sm);
+    pio_sm_exec(pio, sm, pio_encode_set(pio_pins, 1) | pio_encode_sideset(1, 0));
+    pio_sm_exec(pio, sm, pio_encode_jmp(SpiPio.Offset) | pio_encode_sideset(1, 0));
+    pio_sm_set_enabled(pio, sm, true);
+}
+
+bool SpiPioTransfer( Spi_t *obj, uint8_t *header, uint16_t headerSize, const uint8_t *outData, uint8_t *inData, uint16_t size, bool waitBusy )
+{
+    PIO pio = SpiPio.Pio;
+    uint sm = SpiPio.Sm;
+    uint32_t total = headerSize + size;
+    uint32_t tx = 0;
+    uint32_t rx = 0;
+    absolute_time_t deadline = make_timeout_time_us(SPI_PIO_TIMEOUT_US);
+
+    if (total == 0) {
+        return true;
+    }
+
+    pio_sm_put(pio, sm, ((waitBusy && SpiPio.WaitBusy) ? 0x80000000 : 0) | (total - 1));
+
+    while (rx < total) {
+        if ((tx < total) && !pio_sm_is_tx_fifo_full(pio, sm)) {
+            uint8_t b = 0x00;
+
+            if (tx < headerSize) {
+                b = header[tx];
+            } else if (outData != NULL) {
+                b = outData[tx - headerSize];
+            }
+            pio_sm_put(pio, sm, (uint32_t)b << 24);
+            tx++;
+        }
+
+        if (!pio_sm_is_rx_fifo_empty(pio, sm)) {
+            uint8_t b = (uint8_t)pio_sm_get(pio, sm);
+
+            if (rx < headerSize) {
+                header[rx] = b;
+            } else if (inData != NULL) {
+                inData[rx - headerSize] = b;
+            }
+            rx++;
+        } else if (time_reached(deadline)) {
+            // BUSY never dropped or the engine stalled, release the bus
+            SpiPioRestart();
+            return false;
+        }
+    }
+
+    // Return once NSS is high again and the engine waits for the next command
+    while (pio_sm_get_pc(pio, sm) != SpiPio.Offset) {
+        if (time_reached(deadline)) {
+            SpiPioRestart();
+            return false;
+        }
+        tight_loop_contents();
+    }
+
+    SpiStats.Calls++;
+    SpiStats.Bytes += total;
+
+    return true;
+}
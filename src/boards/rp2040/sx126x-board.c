@@ -26,10 +26,17 @@
 #include "sx126x-board.h"
 #include "board.h"
 #include "delay.h"
+#include "eeprom-board.h"
 #include "pico/board-config.h"
+#include "pico/board-rp2040.h"
 #include "radio.h"
 #include "utilities.h"
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "hardware/sync.h"
+#include "pico/time.h"
 
 #if defined(USE_RADIO_DEBUG)
 /*!
@@ -47,11 +54,148 @@ static void SX126xDbgPinTxWrite(uint8_t state);
 static void SX126xDbgPinRxWrite(uint8_t state);
 #endif
 
+/*!
+ * \brief BUSY falling edge interrupt handler
+ *
+ * \param [IN] context Unused
+ */
+static void SX126xOnBusyIrq(void *context);
+
+/*!
+ * \brief Waits for the BUSY line to drop, bounded by SX126X_BUSY_TIMEOUT_US
+ */
+static void SX126xWaitOnBusyPin(void);
+
+/*!
+ * \brief Drops shadowed register values the radio may no longer hold
+ *
+ * \param [IN] retainedToo Also drop the registers kept across warm sleep
+ */
+static void SX126xInvalidateRegisterShadow(bool retainedToo);
+
+/*!
+ * \brief Drops every shadowed configuration command
+ */
+static void SX126xInvalidateCommandShadow(void);
+
 /*!
  * \brief Holds the internal operating mode of the radio
  */
 static RadioOperatingModes_t OperatingMode;
 
+/*!
+ * \brief Staging buffer for radio FIFO loads done through DMA
+ */
+static uint8_t TransferBuffer[256];
+
+/*!
+ * \brief Set while a DMA FIFO transfer is in flight
+ */
+static volatile bool TransferPending = false;
+
+/*!
+ * \brief Opcode of the last command sent, BUSY time is accounted to it
+ */
+static uint8_t BusyOpcode = RADIO_GET_STATUS;
+
+static SX126xBusyStats_t BusyStats[SX126X_BUSY_STATS_SIZE];
+
+static uint32_t BusyTimeouts = 0;
+
+static uint8_t BusyTimeoutOpcode = 0;
+
+static SX126xTransferStats_t TransferStats;
+
+/*!
+ * \brief Write-through shadow of a configuration register byte
+ */
+typedef struct {
+  uint16_t Address;
+  bool Retained; //! Survives a warm start sleep
+  bool Valid;
+  uint8_t Value;
+} SX126xRegisterShadow_t;
+
+/*!
+ * \brief Registers that only change when the host writes them
+ */
+static SX126xRegisterShadow_t RegisterShadow[] = {
+    {.Address = REG_LR_SYNCWORD, .Retained = true},
+    {.Address = REG_LR_SYNCWORD + 1, .Retained = true},
+    {.Address = REG_IQ_POLARITY, .Retained = true},
+    {.Address = REG_OCP, .Retained = false},
+    {.Address = REG_TX_CLAMP_CFG, .Retained = false},
+    {.Address = REG_RX_GAIN, .Retained = false},
+};
+
+/*!
+ * \brief Last parameters sent with a radio configuration command
+ */
+typedef struct {
+  RadioCommands_t Opcode;
+  bool Valid;
+  uint8_t Size;
+  uint8_t Params[9];
+} SX126xCommandShadow_t;
+
+/*!
+ * \brief Configuration commands the radio keeps until reset or cold sleep
+ *
+ * These make up the setup sequence issued before every TX and RX window.
+ * Replaying the same parameters is a no-op for the radio, so only commands
+ * whose parameters changed since they were last sent go over SPI.
+ */
+static SX126xCommandShadow_t CommandShadow[] = {
+    {.Opcode = RADIO_SET_PACKETTYPE},
+    {.Opcode = RADIO_SET_RFFREQUENCY},
+    {.Opcode = RADIO_SET_MODULATIONPARAMS},
+    {.Opcode = RADIO_SET_PACKETPARAMS},
+    {.Opcode = RADIO_SET_PACONFIG},
+    {.Opcode = RADIO_SET_TXPARAMS},
+    {.Opcode = RADIO_SET_BUFFERBASEADDRESS},
+    {.Opcode = RADIO_CFG_DIOIRQ},
+    {.Opcode = RADIO_SET_TCXOMODE},
+    {.Opcode = RADIO_CALIBRATEIMAGE},
+};
+
+/*!
+ * \brief Power state of the radio as last commanded
+ */
+static SX126xRadioState_t RadioState = SX126X_RADIO_COLD;
+
+/*!
+ * \brief CalibrationParams_t blocks calibrated since the last cold start
+ */
+static uint8_t CalibratedBlocks = 0;
+
+static SX126xWakeStats_t WakeStats;
+
+/*!
+ * \brief DIO1 handler registered by the radio driver
+ */
+static DioIrqHandler *Dio1Handler = NULL;
+
+/*!
+ * \brief Time of the last DIO1 edge in TX, the TX done IRQ [us since boot]
+ */
+static volatile uint64_t Dio1TxEdge = 0;
+
+/*!
+ * \brief Time of the first DIO1 edge of the current RX window, the preamble
+ * detected IRQ when a frame arrives [us since boot]
+ */
+static volatile uint64_t Dio1RxEdge = 0;
+
+/*!
+ * \brief Time the last wakeup from sleep started, 0 once SetTx accounted it
+ */
+static uint64_t WakeStart = 0;
+
+/*!
+ * \brief Number of SPI transactions avoided by the shadow registers and commands
+ */
+static uint32_t SavedTransactions = 0;
+
 /*!
  * Antenna switch GPIO pins objects
  */
@@ -66,15 +210,103 @@ Gpio_t DbgPinTx;
 Gpio_t DbgPinRx;
 #endif
 
+static void SX126xOnTransferDone(void *context) { TransferPending = false; }
+
+/*!
+ * \brief Waits for the FIFO transfer started by the previous access to end
+ */
+static void SX126xWaitOnTransfer(void) {
+  if (TransferPending) {
+    SpiWaitIdle(&SX126x.Spi);
+  }
+}
+
+/*!
+ * \brief Runs one NSS framed transaction with the radio
+ *
+ * The header is sent first and overwritten with the bytes received while it
+ * was clocked out, then outData is sent or inData is received.
+ *
+ * \param [IN]     header     Opcode and address bytes
+ * \param [IN]     headerSize Number of header bytes
+ * \param [IN]     outData    Payload to send, NULL when receiving
+ * \param [OUT]    inData     Payload received, NULL when sending
+ * \param [IN]     size       Payload size
+ * \param [IN]     waitBusy   Let the PIO engine wait for BUSY before NSS
+ * \retval done                False if the PIO engine timed out, the radio
+ *                            may not have received the transaction
+ */
+static bool SX126xTransfer(uint8_t *header, uint16_t headerSize, const uint8_t *outData,
+                           uint8_t *inData, uint16_t size, bool waitBusy) {
+  uint32_t start = time_us_32();
+  bool done = true;
+
+  if (SpiIsPio(&SX126x.Spi)) {
+    uint8_t opcode = header[0];
+
+    done = SpiPioTransfer(&SX126x.Spi, header, headerSize, outData, inData, size, waitBusy);
+    if (!done) {
+      BusyTimeouts++;
+      BusyTimeoutOpcode = opcode;
+    }
+  } else {
+    GpioWrite(&SX126x.Spi.Nss, 0);
+
+    SpiTransfer(&SX126x.Spi, header, header, headerSize);
+    if (outData != NULL) {
+      SpiOut(&SX126x.Spi, outData, size);
+    } else if (inData != NULL) {
+      SpiIn(&SX126x.Spi, inData, size);
+    }
+
+    GpioWrite(&SX126x.Spi.Nss, 1);
+  }
+
+  TransferStats.Count++;
+  TransferStats.Bytes += headerSize + size;
+  TransferStats.TotalUs += time_us_32() - start;
+
+  return done;
+}
+
 void SX126xIoInit(void) {
   GpioInit(&SX126x.Spi.Nss, RADIO_NSS, PIN_OUTPUT, PIN_PUSH_PULL, PIN_NO_PULL, 1);
   GpioInit(&SX126x.BUSY, RADIO_BUSY, PIN_INPUT, PIN_PUSH_PULL, PIN_NO_PULL, 0);
   GpioInit(&SX126x.DIO1, RADIO_DIO_1, PIN_INPUT, PIN_PUSH_PULL, PIN_NO_PULL, 0);
+  GpioSetInterrupt(&SX126x.BUSY, IRQ_FALLING_EDGE, IRQ_LOW_PRIORITY, SX126xOnBusyIrq);
   // GpioInit(&DeviceSel, RADIO_DEVICE_SEL, PIN_INPUT, PIN_PUSH_PULL, PIN_NO_PULL, 0);
 }
 
+static void SX126xOnDio1Irq(void *context) {
+  uint64_t now = time_us_64();
+
+  if (OperatingMode == MODE_TX) {
+    Dio1TxEdge = now;
+  } else if ((OperatingMode == MODE_RX) && (Dio1RxEdge == 0)) {
+    Dio1RxEdge = now;
+  }
+
+  Dio1Handler(context);
+}
+
 void SX126xIoIrqInit(DioIrqHandler dioIrq) {
-  GpioSetInterrupt(&SX126x.DIO1, IRQ_RISING_EDGE, IRQ_HIGH_PRIORITY, dioIrq);
+  Dio1Handler = dioIrq;
+
+  GpioSetInterrupt(&SX126x.DIO1, IRQ_RISING_EDGE, IRQ_HIGH_PRIORITY, SX126xOnDio1Irq);
+}
+
+bool SX126xGetRxTiming(uint64_t *txDoneUs, uint64_t *rxEdgeUs) {
+  uint64_t txEdge = Dio1TxEdge;
+  uint64_t rxEdge = Dio1RxEdge;
+
+  if ((txEdge == 0) || (rxEdge <= txEdge)) {
+    return false;
+  }
+
+  *txDoneUs = txEdge;
+  *rxEdgeUs = rxEdge;
+
+  return true;
 }
 
 void SX126xIoDeInit(void) {
@@ -105,6 +337,11 @@ void SX126xIoRfSwitchInit(void) { SX126xSetDio2AsRfSwitchCtrl(true); }
 RadioOperatingModes_t SX126xGetOperatingMode(void) { return OperatingMode; }
 
 void SX126xSetOperatingMode(RadioOperatingModes_t mode) {
+  if (mode == MODE_RX) {
+    // Each window times its own first edge
+    Dio1RxEdge = 0;
+  }
+
   OperatingMode = mode;
 #if defined(USE_RADIO_DEBUG)
   switch (mode) {
@@ -126,50 +363,287 @@ void SX126xSetOperatingMode(RadioOperatingModes_t mode) {
 }
 
 void SX126xReset(void) {
-  DelayMs(10);
+  SX126xInvalidateRegisterShadow(true);
+  SX126xInvalidateCommandShadow();
+  CalibratedBlocks = 0;
+  RadioState = SX126X_RADIO_COLD;
+
+  // NRESET only has to be held low for 100 us
   GpioInit(&SX126x.Reset, RADIO_RESET, PIN_OUTPUT, PIN_PUSH_PULL, PIN_NO_PULL, 0);
-  DelayMs(20);
+  DelayMs(1);
   // internal pull-up
   GpioInit(&SX126x.Reset, RADIO_RESET, PIN_ANALOGIC, PIN_PUSH_PULL, PIN_NO_PULL, 0);
-  DelayMs(10);
+
+  // BUSY stays high until the radio has booted into STDBY_RC
+  BusyOpcode = SX126X_BUSY_OPCODE_RESET;
+  SX126xWaitOnBusyPin();
+
+  RadioState = SX126X_RADIO_STANDBY;
+}
+
+static void SX126xRecordBusy(uint8_t opcode, uint32_t duration) {
+  SX126xBusyStats_t *entry = NULL;
+
+  for (uint i = 0; i < SX126X_BUSY_STATS_SIZE; i++) {
+    if (BusyStats[i].Count == 0) {
+      // Entries are filled in order, so the opcode has not been seen yet
+      entry = &BusyStats[i];
+      entry->Opcode = opcode;
+      entry->MinUs = UINT32_MAX;
+      break;
+    } else if (BusyStats[i].Opcode == opcode) {
+      entry = &BusyStats[i];
+      break;
+    }
+  }
+
+  if (entry == NULL) {
+    return;
+  }
+
+  entry->Count++;
+  entry->TotalUs += duration;
+  if (duration < entry->MinUs) {
+    entry->MinUs = duration;
+  }
+  if (duration > entry->MaxUs) {
+    entry->MaxUs = duration;
+  }
+}
+
+static void SX126xOnBusyIrq(void *context) {
+  // Nothing to do, the IRQ only wakes SX126xWaitOnBusy from WFE
+  __sev();
+}
+
+static void SX126xWaitOnBusyPin(void) {
+  if (GpioRead(&SX126x.BUSY) == 0) {
+    SX126xRecordBusy(BusyOpcode, 0);
+    return;
+  }
+
+  uint32_t status = save_and_disable_interrupts();
+  restore_interrupts(status);
+
+  // WFE relies on the BUSY IRQ, which only fires from thread mode with
+  // interrupts enabled
+  bool canSleep = (__get_current_exception() == 0) && ((status & 1) == 0);
+  uint64_t start = time_us_64();
+  absolute_time_t deadline = from_us_since_boot(start + SX126X_BUSY_TIMEOUT_US);
+
+  while (GpioRead(&SX126x.BUSY) == 1) {
+    uint64_t now = time_us_64();
+
+    if (time_reached(deadline)) {
+      BusyTimeouts++;
+      BusyTimeoutOpcode = BusyOpcode;
+      SX126xRecordBusy(BusyOpcode, now - start);
+      return;
+    }
+
+    if (canSleep && ((now - start) >= SX126X_BUSY_SPIN_US)) {
+      best_effort_wfe_or_timeout(deadline);
+    }
+  }
+
+  SX126xRecordBusy(BusyOpcode, time_us_64() - start);
 }
 
 void SX126xWaitOnBusy(void) {
-  while (GpioRead(&SX126x.BUSY) == 1)
-    ;
+  if (SpiPioWaitsOnBusy(&SX126x.Spi)) {
+    // The PIO engine holds the next transaction until BUSY drops
+    return;
+  }
+
+  SX126xWaitOnBusyPin();
 }
 
+bool SX126xGetBusyStats(uint8_t opcode, SX126xBusyStats_t *stats) {
+  for (uint i = 0; i < SX126X_BUSY_STATS_SIZE; i++) {
+    if (BusyStats[i].Count == 0) {
+      break;
+    } else if (BusyStats[i].Opcode == opcode) {
+      *stats = BusyStats[i];
+      return true;
+    }
+  }
+
+  return false;
+}
+
+uint32_t SX126xGetBusyTimeouts(uint8_t *lastOpcode) {
+  if (lastOpcode != NULL) {
+    *lastOpcode = BusyTimeoutOpcode;
+  }
+
+  return BusyTimeouts;
+}
+
+void SX126xResetBusyStats(void) {
+  memset(BusyStats, 0, sizeof(BusyStats));
+  BusyTimeouts = 0;
+}
+
+void SX126xGetTransferStats(SX126xTransferStats_t *stats) { *stats = TransferStats; }
+
+void SX126xResetTransferStats(void) { memset(&TransferStats, 0, sizeof(TransferStats)); }
+
 void SX126xWakeup(void) {
+  uint8_t header[2] = {RADIO_GET_STATUS, 0x00};
+
+  SX126xWaitOnTransfer();
+
+  if (RadioState == SX126X_RADIO_WARM_SLEEP) {
+    WakeStats.WarmWakeups++;
+    WakeStart = time_us_64();
+  } else if (RadioState == SX126X_RADIO_COLD) {
+    WakeStats.ColdWakeups++;
+    WakeStart = time_us_64();
+  }
+
   CRITICAL_SECTION_BEGIN();
 
-  GpioWrite(&SX126x.Spi.Nss, 0);
+  // BUSY stays high while the radio sleeps, the NSS edge is what wakes it
+  SX126xTransfer(header, sizeof(header), NULL, NULL, 0, false);
 
-  SpiInOut(&SX126x.Spi, RADIO_GET_STATUS);
-  SpiInOut(&SX126x.Spi, 0x00);
+  CRITICAL_SECTION_END();
 
-  GpioWrite(&SX126x.Spi.Nss, 1);
+  BusyOpcode = RADIO_GET_STATUS;
 
-  // Wait for chip to be ready.
+  // Wait for chip to be ready, outside of the critical section so that a
+  // hung radio cannot hold off every interrupt
   SX126xWaitOnBusy();
 
+  RadioState = SX126X_RADIO_STANDBY;
+
   // Update operating mode context variable
   SX126xSetOperatingMode(MODE_STDBY_RC);
+}
 
-  CRITICAL_SECTION_END();
+SX126xRadioState_t SX126xGetRadioState(void) { return RadioState; }
+
+uint8_t SX126xGetCalibratedBlocks(void) { return CalibratedBlocks; }
+
+void SX126xGetWakeStats(SX126xWakeStats_t *stats) { *stats = WakeStats; }
+
+void SX126xResetWakeStats(void) { memset(&WakeStats, 0, sizeof(WakeStats)); }
+
+static SX126xRegisterShadow_t *SX126xGetRegisterShadow(uint16_t address) {
+  for (uint i = 0; i < count_of(RegisterShadow); i++) {
+    if (RegisterShadow[i].Address == address) {
+      return &RegisterShadow[i];
+    }
+  }
+
+  return NULL;
+}
+
+static void SX126xInvalidateRegisterShadow(bool retainedToo) {
+  for (uint i = 0; i < count_of(RegisterShadow); i++) {
+    if (retainedToo || !RegisterShadow[i].Retained) {
+      RegisterShadow[i].Valid = false;
+    }
+  }
+}
+
+static SX126xCommandShadow_t *SX126xGetCommandShadow(RadioCommands_t command) {
+  for (uint i = 0; i < count_of(CommandShadow); i++) {
+    if (CommandShadow[i].Opcode == command) {
+      return &CommandShadow[i];
+    }
+  }
+
+  return NULL;
+}
+
+static void SX126xInvalidateCommandShadow(void) {
+  for (uint i = 0; i < count_of(CommandShadow); i++) {
+    CommandShadow[i].Valid = false;
+  }
 }
 
+uint32_t SX126xGetSavedTransactions(void) { return SavedTransactions; }
+
+void SX126xResetSavedTransactions(void) { SavedTransactions = 0; }
+
 void SX126xWriteCommand(RadioCommands_t command, uint8_t *buffer, uint16_t size) {
-  SX126xCheckDeviceReady();
+  uint8_t header = (uint8_t)command;
+  SX126xCommandShadow_t *shadow = SX126xGetCommandShadow(command);
+
+  if ((command == RADIO_CALIBRATE) && (size == 1) && ((buffer[0] & ~CalibratedBlocks) == 0)) {
+    // Every requested block still holds its calibration
+    WakeStats.CalibrationsSkipped++;
+    SavedTransactions++;
+    return;
+  }
 
-  GpioWrite(&SX126x.Spi.Nss, 0);
+  if ((shadow != NULL) && (size <= sizeof(shadow->Params))) {
+    if (shadow->Valid && (shadow->Size == size) && (memcmp(shadow->Params, buffer, size) == 0)) {
+      if (command == RADIO_CALIBRATEIMAGE) {
+        WakeStats.CalibrationsSkipped++;
+      }
+      SavedTransactions++;
+      return;
+    }
+  } else {
+    shadow = NULL;
+  }
 
-  SpiInOut(&SX126x.Spi, (uint8_t)command);
+  if (command == RADIO_SET_PACKETTYPE) {
+    // Modulation and packet parameters are interpreted per packet type
+    SX126xGetCommandShadow(RADIO_SET_MODULATIONPARAMS)->Valid = false;
+    SX126xGetCommandShadow(RADIO_SET_PACKETPARAMS)->Valid = false;
+  }
 
-  for (uint16_t i = 0; i < size; i++) {
-    SpiInOut(&SX126x.Spi, buffer[i]);
+  SX126xWaitOnTransfer();
+  SX126xCheckDeviceReady();
+
+  bool done = SX126xTransfer(&header, 1, buffer, NULL, size, true);
+
+  // The shadow only holds what the radio is known to have received
+  if (shadow != NULL) {
+    memcpy(shadow->Params, buffer, size);
+    shadow->Size = size;
+    shadow->Valid = done;
   }
 
-  GpioWrite(&SX126x.Spi.Nss, 1);
+  BusyOpcode = command;
+
+  if (command == RADIO_SET_SLEEP) {
+    // Bit 2 of the sleep config selects warm start
+    bool coldStart = (size == 0) || ((buffer[0] & 0x04) == 0);
+
+    SX126xInvalidateRegisterShadow(coldStart);
+    if (coldStart) {
+      SX126xInvalidateCommandShadow();
+      CalibratedBlocks = 0;
+    }
+
+    RadioState = coldStart ? SX126X_RADIO_COLD : SX126X_RADIO_WARM_SLEEP;
+  } else if (command == RADIO_SET_PACONFIG) {
+    // SetPaConfig reloads the default over current protection
+    SX126xGetRegisterShadow(REG_OCP)->Valid = false;
+  } else if (command == RADIO_SET_TCXOMODE) {
+    // Calibrations made on the previous reference clock no longer hold
+    CalibratedBlocks = 0;
+    SX126xGetCommandShadow(RADIO_CALIBRATEIMAGE)->Valid = false;
+  } else if ((command == RADIO_CALIBRATE) && done) {
+    CalibratedBlocks |= buffer[0];
+    if ((buffer[0] & 0x40) != 0) {
+      // The image is recalibrated for the default band
+      SX126xGetCommandShadow(RADIO_CALIBRATEIMAGE)->Valid = false;
+    }
+  } else if ((command == RADIO_SET_TX) && (WakeStart != 0)) {
+    uint32_t latency = time_us_64() - WakeStart;
+
+    WakeStart = 0;
+    WakeStats.WakeToTxCount++;
+    WakeStats.LastWakeToTxUs = latency;
+    WakeStats.TotalWakeToTxUs += latency;
+    if (latency > WakeStats.MaxWakeToTxUs) {
+      WakeStats.MaxWakeToTxUs = latency;
+    }
+  }
 
   if (command != RADIO_SET_SLEEP) {
     SX126xWaitOnBusy();
@@ -177,39 +651,53 @@ void SX126xWriteCommand(RadioCommands_t command, uint8_t *buffer, uint16_t size)
 }
 
 uint8_t SX126xReadCommand(RadioCommands_t command, uint8_t *buffer, uint16_t size) {
-  uint8_t status = 0;
+  uint8_t header[2] = {(uint8_t)command, 0x00};
 
+  SX126xWaitOnTransfer();
   SX126xCheckDeviceReady();
 
-  GpioWrite(&SX126x.Spi.Nss, 0);
-
-  SpiInOut(&SX126x.Spi, (uint8_t)command);
-  status = SpiInOut(&SX126x.Spi, 0x00);
-  for (uint16_t i = 0; i < size; i++) {
-    buffer[i] = SpiInOut(&SX126x.Spi, 0);
-  }
+  // The status byte is clocked out during the NOP following the opcode
+  SX126xTransfer(header, sizeof(header), NULL, buffer, size, true);
 
-  GpioWrite(&SX126x.Spi.Nss, 1);
+  BusyOpcode = command;
 
   SX126xWaitOnBusy();
 
-  return status;
+  return header[1];
 }
 
 void SX126xWriteRegisters(uint16_t address, uint8_t *buffer, uint16_t size) {
-  SX126xCheckDeviceReady();
+  uint8_t header[3] = {RADIO_WRITE_REGISTER, (address & 0xFF00) >> 8, address & 0x00FF};
+  bool unchanged = true;
 
-  GpioWrite(&SX126x.Spi.Nss, 0);
+  for (uint16_t i = 0; i < size; i++) {
+    SX126xRegisterShadow_t *shadow = SX126xGetRegisterShadow(address + i);
+
+    if ((shadow == NULL) || !shadow->Valid || (shadow->Value != buffer[i])) {
+      unchanged = false;
+    }
+  }
+
+  if (unchanged) {
+    SavedTransactions++;
+    return;
+  }
+
+  SX126xWaitOnTransfer();
+  SX126xCheckDeviceReady();
 
-  SpiInOut(&SX126x.Spi, RADIO_WRITE_REGISTER);
-  SpiInOut(&SX126x.Spi, (address & 0xFF00) >> 8);
-  SpiInOut(&SX126x.Spi, address & 0x00FF);
+  bool done = SX126xTransfer(header, sizeof(header), buffer, NULL, size, true);
 
   for (uint16_t i = 0; i < size; i++) {
-    SpiInOut(&SX126x.Spi, buffer[i]);
+    SX126xRegisterShadow_t *shadow = SX126xGetRegisterShadow(address + i);
+
+    if (shadow != NULL) {
+      shadow->Value = buffer[i];
+      shadow->Valid = done;
+    }
   }
 
-  GpioWrite(&SX126x.Spi.Nss, 1);
+  BusyOpcode = RADIO_WRITE_REGISTER;
 
   SX126xWaitOnBusy();
 }
@@ -219,20 +707,41 @@ void SX126xWriteRegister(uint16_t address, uint8_t value) {
 }
 
 void SX126xReadRegisters(uint16_t address, uint8_t *buffer, uint16_t size) {
-  SX126xCheckDeviceReady();
+  uint8_t header[4] = {RADIO_READ_REGISTER, (address & 0xFF00) >> 8, address & 0x00FF, 0x00};
+  uint16_t i;
 
-  GpioWrite(&SX126x.Spi.Nss, 0);
+  for (i = 0; i < size; i++) {
+    SX126xRegisterShadow_t *shadow = SX126xGetRegisterShadow(address + i);
 
-  SpiInOut(&SX126x.Spi, RADIO_READ_REGISTER);
-  SpiInOut(&SX126x.Spi, (address & 0xFF00) >> 8);
-  SpiInOut(&SX126x.Spi, address & 0x00FF);
-  SpiInOut(&SX126x.Spi, 0);
-  for (uint16_t i = 0; i < size; i++) {
-    buffer[i] = SpiInOut(&SX126x.Spi, 0);
+    if ((shadow == NULL) || !shadow->Valid) {
+      break;
+    }
+
+    buffer[i] = shadow->Value;
+  }
+
+  if (i == size) {
+    SavedTransactions++;
+    return;
   }
-  GpioWrite(&SX126x.Spi.Nss, 1);
+
+  SX126xWaitOnTransfer();
+  SX126xCheckDeviceReady();
+
+  bool done = SX126xTransfer(header, sizeof(header), NULL, buffer, size, true);
+
+  BusyOpcode = RADIO_READ_REGISTER;
 
   SX126xWaitOnBusy();
+
+  for (i = 0; i < size; i++) {
+    SX126xRegisterShadow_t *shadow = SX126xGetRegisterShadow(address + i);
+
+    if ((shadow != NULL) && done) {
+      shadow->Value = buffer[i];
+      shadow->Valid = true;
+    }
+  }
 }
 
 uint8_t SX126xReadRegister(uint16_t address) {
@@ -242,36 +751,151 @@ uint8_t SX126xReadRegister(uint16_t address) {
 }
 
 void SX126xWriteBuffer(uint8_t offset, uint8_t *buffer, uint8_t size) {
+  uint8_t header[2] = {RADIO_WRITE_BUFFER, offset};
+
+  SX126xWaitOnTransfer();
   SX126xCheckDeviceReady();
 
-  GpioWrite(&SX126x.Spi.Nss, 0);
+  BusyOpcode = RADIO_WRITE_BUFFER;
 
-  SpiInOut(&SX126x.Spi, RADIO_WRITE_BUFFER);
-  SpiInOut(&SX126x.Spi, offset);
-  for (uint16_t i = 0; i < size; i++) {
-    SpiInOut(&SX126x.Spi, buffer[i]);
+  if (SpiIsPio(&SX126x.Spi)) {
+    SX126xTransfer(header, sizeof(header), buffer, NULL, size, true);
+    SX126xWaitOnBusy();
+    return;
   }
-  GpioWrite(&SX126x.Spi.Nss, 1);
 
-  SX126xWaitOnBusy();
+  // Keep a private copy so the caller's buffer is free as soon as we return
+  memcpy(TransferBuffer, buffer, size);
+  TransferPending = true;
+
+  GpioWrite(&SX126x.Spi.Nss, 0);
+
+  SpiOut(&SX126x.Spi, header, sizeof(header));
+
+  // NSS is released by the SPI layer, BUSY is checked by the next access
+  SpiOutAsync(&SX126x.Spi, TransferBuffer, size, SX126xOnTransferDone, NULL);
 }
 
 void SX126xReadBuffer(uint8_t offset, uint8_t *buffer, uint8_t size) {
+  uint8_t header[3] = {RADIO_READ_BUFFER, offset, 0x00};
+
+  SX126xWaitOnTransfer();
   SX126xCheckDeviceReady();
 
-  GpioWrite(&SX126x.Spi.Nss, 0);
+  BusyOpcode = RADIO_READ_BUFFER;
 
-  SpiInOut(&SX126x.Spi, RADIO_READ_BUFFER);
-  SpiInOut(&SX126x.Spi, offset);
-  SpiInOut(&SX126x.Spi, 0);
-  for (uint16_t i = 0; i < size; i++) {
-    buffer[i] = SpiInOut(&SX126x.Spi, 0);
-  }
-  GpioWrite(&SX126x.Spi.Nss, 1);
+  // The radio driver uses the payload as soon as this returns, so reads
+  // block. Only FIFO loads run in the background.
+  SX126xTransfer(header, sizeof(header), NULL, buffer, size, true);
 
   SX126xWaitOnBusy();
 }
 
+/*!
+ * \brief SPI clock rates tried by SX126xCharacterizeSpi, slowest first [Hz]
+ */
+static const uint32_t SpiRates[] = {2000000, 4000000, 8000000, 10000000, 12000000, 16000000};
+
+#define SPI_RECORD_MAGIC 0x53504931 // "SPI1"
+
+/*!
+ * \brief SPI clock record kept at SX126X_SPI_NVM_ADDRESS
+ */
+typedef struct {
+  uint32_t Magic;
+  uint32_t Hz;
+  uint32_t Crc; //! Crc32 of Magic and Hz
+} SX126xSpiRecord_t;
+
+/*!
+ * \brief Checks the link at the current SPI clock with data buffer round trips
+ *
+ * \retval passed True if every pattern read back intact
+ */
+static bool SX126xCheckSpiLink(void) {
+  uint8_t pattern[255];
+  uint8_t readback[sizeof(pattern)];
+  uint32_t timeouts = BusyTimeouts;
+  uint32_t lfsr = 0xACE1;
+
+  for (uint round = 0; round < 4; round++) {
+    for (uint i = 0; i < sizeof(pattern); i++) {
+      switch (round) {
+      case 0:
+        pattern[i] = (i & 1) ? 0xAA : 0x55;
+        break;
+      case 1:
+        pattern[i] = (i & 1) ? 0xFF : 0x00;
+        break;
+      case 2:
+        pattern[i] = i;
+        break;
+      default:
+        lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & 0xB400);
+        pattern[i] = lfsr;
+        break;
+      }
+    }
+
+    SX126xWriteBuffer(0, pattern, sizeof(pattern));
+    SX126xReadBuffer(0, readback, sizeof(readback));
+
+    if (memcmp(pattern, readback, sizeof(pattern)) != 0) {
+      return false;
+    }
+  }
+
+  // A garbled command shows up as a radio that never drops BUSY
+  return BusyTimeouts == timeouts;
+}
+
+uint32_t SX126xCharacterizeSpi(void) {
+  int fastest = -1;
+
+  for (uint i = 0; i < count_of(SpiRates); i++) {
+    SpiFrequency(&SX126x.Spi, SpiRates[i]);
+
+    if (!SX126xCheckSpiLink()) {
+      break;
+    }
+    fastest = i;
+  }
+
+  if (fastest < 0) {
+    SpiFrequency(&SX126x.Spi, SPI_DEFAULT_FREQUENCY);
+    return 0;
+  }
+
+  // Keep one step of margin below the fastest passing rate
+  SX126xSpiRecord_t record = {
+      .Magic = SPI_RECORD_MAGIC,
+      .Hz = SpiRates[(fastest > 0) ? fastest - 1 : 0],
+  };
+  record.Crc = Crc32((uint8_t *)&record, offsetof(SX126xSpiRecord_t, Crc));
+
+  SpiFrequency(&SX126x.Spi, record.Hz);
+
+  // Flushed along with the LoRaMac NVM data, flash stalls the CPU
+  EepromMcuWriteBuffer(SX126X_SPI_NVM_ADDRESS, (uint8_t *)&record, sizeof(record));
+
+  return record.Hz;
+}
+
+uint32_t SX126xLoadSpiFrequency(void) {
+  SX126xSpiRecord_t record;
+
+  EepromMcuReadBuffer(SX126X_SPI_NVM_ADDRESS, (uint8_t *)&record, sizeof(record));
+
+  if ((record.Magic != SPI_RECORD_MAGIC) ||
+      (record.Crc != Crc32((uint8_t *)&record, offsetof(SX126xSpiRecord_t, Crc)))) {
+    return 0;
+  }
+
+  SpiFrequency(&SX126x.Spi, record.Hz);
+
+  return record.Hz;
+}
+
 void SX126xSetRfTxPower(int8_t power) { SX126xSetTxParams(power, RADIO_RAMP_40_US); }
 
 uint8_t SX126xGetDeviceId(void) { return SX1262; }
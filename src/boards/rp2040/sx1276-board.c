@@ -27,9 +27,8 @@
 
 #include <stddef.h>
 
-#include "hardware/gpio.h"
-
 #include "delay.h"
+#include "gpio.h"
 #include "sx1276-board.h"
 
 #include "radio/radio.h"
@@ -65,17 +64,6 @@ const struct Radio_s Radio =
     NULL, // void ( *SetRxDutyCycle )( uint32_t rxTime, uint32_t sleepTime ) - SX126x Only
 };
 
-static DioIrqHandler** irq_handlers;
-
-void dio_gpio_callback(uint gpio, uint32_t events)
-{
-    if (gpio == SX1276.DIO0.pin) {
-        irq_handlers[0](NULL);
-    } else if (gpio == SX1276.DIO1.pin) {
-        irq_handlers[1](NULL);
-    }
-}
-
 void SX1276SetAntSwLowPower( bool status )
 {
 }
@@ -120,10 +108,8 @@ void SX1276IoInit( void )
 
 void SX1276IoIrqInit( DioIrqHandler **irqHandlers )
 {
-    irq_handlers = irqHandlers;
-
-    gpio_set_irq_enabled_with_callback(SX1276.DIO0.pin, GPIO_IRQ_EDGE_RISE, true, &dio_gpio_callback);
-    gpio_set_irq_enabled_with_callback(SX1276.DIO1.pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true, &dio_gpio_callback);
+    GpioSetInterrupt( &SX1276.DIO0, IRQ_RISING_EDGE, IRQ_HIGH_PRIORITY, irqHandlers[0] );
+    GpioSetInterrupt( &SX1276.DIO1, IRQ_RISING_FALLING_EDGE, IRQ_HIGH_PRIORITY, irqHandlers[1] );
 }
 
 /*!
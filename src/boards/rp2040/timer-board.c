@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Drop-in replacement for LoRaMac-node's system/timer.c. Running timers are
+ * kept in a binary min-heap ordered by expiry time, with a start sequence
+ * number breaking ties, so TimerStart and TimerStop are O(log n) and timers
+ * expiring together fire in the order they were started.
+ */
+
+#include "pico/stdlib.h"
+
+#include "board.h"
+#include "rtc-board.h"
+#include "timer.h"
+#include "utilities.h"
+#include "pico/board-rp2040.h"
+
+/*!
+ * Heap slot of a running timer
+ */
+typedef struct {
+    TimerEvent_t *Obj;
+    uint64_t Expiry; //! Expiry time [us since boot]
+    uint32_t Seq;    //! Start order, breaks ties between equal expiry times
+} TimerHeapEntry_t;
+
+static TimerHeapEntry_t TimerHeap[TIMER_HEAP_SIZE];
+
+static uint32_t TimerHeapCount = 0;
+
+static uint32_t TimerSeq = 0;
+
+/*!
+ * A running timer keeps its heap index + 1 in its otherwise unused Next
+ * pointer, so it can be removed without searching the heap
+ */
+static inline void TimerSetIndex( TimerEvent_t *obj, uint32_t index )
+{
+    obj->Next = (TimerEvent_t *)(uintptr_t)(index + 1);
+}
+
+static inline uint32_t TimerGetIndex( TimerEvent_t *obj )
+{
+    return (uint32_t)(uintptr_t)obj->Next - 1;
+}
+
+static inline bool TimerHeapLess( uint32_t a, uint32_t b )
+{
+    if (TimerHeap[a].Expiry != TimerHeap[b].Expiry) {
+        return TimerHeap[a].Expiry < TimerHeap[b].Expiry;
+    }
+
+    // Sequence numbers wrap, compare their distance
+    return (int32_t)(TimerHeap[a].Seq - TimerHeap[b].Seq) < 0;
+}
+
+static inline void TimerHeapSwap( uint32_t a, uint32_t b )
+{
+    TimerHeapEntry_t entry = TimerHeap[a];
+
+    TimerHeap[a] = TimerHeap[b];
+    TimerHeap[b] = entry;
+
+    TimerSetIndex(TimerHeap[a].Obj, a);
+    TimerSetIndex(TimerHeap[b].Obj, b);
+}
+
+static void TimerHeapUp( uint32_t index )
+{
+    while (index > 0) {
+        uint32_t parent = (index - 1) / 2;
+
+        if (!TimerHeapLess(index, parent)) {
+            break;
+        }
+        TimerHeapSwap(index, parent);
+        index = parent;
+    }
+}
+
+static void TimerHeapDown( uint32_t index )
+{
+    for (;;) {
+        uint32_t smallest = index;
+        uint32_t left = 2 * index + 1;
+        uint32_t right = left + 1;
+
+        if ((left < TimerHeapCount) && TimerHeapLess(left, smallest)) {
+            smallest = left;
+        }
+        if ((right < TimerHeapCount) && TimerHeapLess(right, smallest)) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            break;
+        }
+        TimerHeapSwap(index, smallest);
+        index = smallest;
+    }
+}
+
+static void TimerHeapRemove( uint32_t index )
+{
+    TimerEvent_t *obj = TimerHeap[index].Obj;
+
+    TimerHeapCount--;
+
+    if (index != TimerHeapCount) {
+        TimerHeap[index] = TimerHeap[TimerHeapCount];
+        TimerSetIndex(TimerHeap[index].Obj, index);
+
+        // The moved entry may belong above or below its new slot
+        if ((index > 0) && TimerHeapLess(index, (index - 1) / 2)) {
+            TimerHeapUp(index);
+        } else {
+            TimerHeapDown(index);
+        }
+    }
+
+    obj->Next = NULL;
+    obj->IsStarted = false;
+    obj->IsNext2Expire = false;
+}
+
+/*!
+ * \brief Points the RTC alarm at the timer on top of the heap
+ */
+static void TimerArm( void )
+{
+    if (TimerHeapCount == 0) {
+        RtcStopAlarm();
+        return;
+    }
+
+    TimerHeap[0].Obj->IsNext2Expire = true;
+
+    RtcSetAlarmUs(TimerHeap[0].Expiry);
+}
+
+void TimerInit( TimerEvent_t *obj, void ( *callback )( void *context ) )
+{
+    obj->Timestamp = 0;
+    obj->ReloadValue = 0;
+    obj->IsStarted = false;
+    obj->IsNext2Expire = false;
+    obj->Callback = callback;
+    obj->Context = NULL;
+    obj->Next = NULL;
+}
+
+void TimerSetContext( TimerEvent_t *obj, void* context )
+{
+    obj->Context = context;
+}
+
+void TimerStart( TimerEvent_t *obj )
+{
+    CRITICAL_SECTION_BEGIN( );
+
+    if ((obj == NULL) || obj->IsStarted) {
+        CRITICAL_SECTION_END( );
+        return;
+    }
+
+    if (TimerHeapCount == TIMER_HEAP_SIZE) {
+        panic("TimerStart: more than TIMER_HEAP_SIZE timers running");
+    }
+
+    TimerEvent_t *top = (TimerHeapCount > 0) ? TimerHeap[0].Obj : NULL;
+    uint32_t index = TimerHeapCount++;
+
+    TimerHeap[index].Obj = obj;
+    TimerHeap[index].Expiry = time_us_64() + (uint64_t)RtcTick2Ms(obj->ReloadValue) * 1000;
+    TimerHeap[index].Seq = TimerSeq++;
+    TimerSetIndex(obj, index);
+
+    obj->Timestamp = obj->ReloadValue;
+    obj->IsStarted = true;
+    obj->IsNext2Expire = false;
+
+    TimerHeapUp(index);
+
+    if (TimerHeap[0].Obj == obj) {
+        if (top != NULL) {
+            top->IsNext2Expire = false;
+        }
+        TimerArm();
+    }
+
+    CRITICAL_SECTION_END( );
+}
+
+bool TimerIsStarted( TimerEvent_t *obj )
+{
+    return obj->IsStarted;
+}
+
+void TimerIrqHandler( void )
+{
+    for (;;) {
+        CRITICAL_SECTION_BEGIN( );
+
+        if ((TimerHeapCount == 0) || (TimerHeap[0].Expiry > time_us_64())) {
+            TimerArm();
+            CRITICAL_SECTION_END( );
+            break;
+        }
+
+        TimerEvent_t *obj = TimerHeap[0].Obj;
+
+        TimerHeapRemove(0);
+
+        CRITICAL_SECTION_END( );
+
+        // The callback may start or stop timers, the heap is consistent here
+        if (obj->Callback != NULL) {
+            obj->Callback(obj->Context);
+        }
+    }
+}
+
+void TimerStop( TimerEvent_t *obj )
+{
+    CRITICAL_SECTION_BEGIN( );
+
+    if ((obj == NULL) || !obj->IsStarted) {
+        CRITICAL_SECTION_END( );
+        return;
+    }
+
+    uint32_t index = TimerGetIndex(obj);
+
+    TimerHeapRemove(index);
+
+    if (index == 0) {
+        TimerArm();
+    }
+
+    CRITICAL_SECTION_END( );
+}
+
+void TimerReset( TimerEvent_t *obj )
+{
+    TimerStop(obj);
+    TimerStart(obj);
+}
+
+void TimerSetValue( TimerEvent_t *obj, uint32_t value )
+{
+    uint32_t minValue = 0;
+    uint32_t ticks = RtcMs2Tick(value);
+
+    TimerStop(obj);
+
+    minValue = RtcGetMinimumTimeout();
+
+    if (ticks < minValue) {
+        ticks = minValue;
+    }
+
+    obj->Timestamp = ticks;
+    obj->ReloadValue = ticks;
+}
+
+TimerTime_t TimerGetCurrentTime( void )
+{
+    uint32_t now = RtcGetTimerValue();
+
+    return RtcTick2Ms(now);
+}
+
+TimerTime_t TimerGetElapsedTime( TimerTime_t past )
+{
+    if (past == 0) {
+        return 0;
+    }
+
+    uint32_t nowInTicks = RtcGetTimerValue();
+    uint32_t pastInTicks = RtcMs2Tick(past);
+
+    // Intentional wrap around. Works Ok if tick duration below 1ms
+    return RtcTick2Ms(nowInTicks - pastInTicks);
+}
+
+TimerTime_t TimerTempCompensation( TimerTime_t period, float temperature )
+{
+    return RtcTempCompensation(period, temperature);
+}
+
+void TimerProcess( void )
+{
+    RtcProcess( );
+}
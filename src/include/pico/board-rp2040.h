@@ -0,0 +1,581 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * RP2040 extensions to the LoRaMac-node board interface.
+ */
+
+#ifndef _PICO_BOARD_RP2040_H_
+#define _PICO_BOARD_RP2040_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hardware/flash.h"
+#include "hardware/pio.h"
+#include "pico/time.h"
+
+#include "spi.h"
+
+/*!
+ * SPI traffic counters, accumulated over every call into the SPI board layer
+ */
+typedef struct SpiStats_s {
+  uint32_t Calls; //! Number of transfers issued to the SPI peripheral
+  uint32_t Bytes; //! Number of bytes clocked over the bus
+} SpiStats_t;
+
+/*!
+ * SPI clock frequency set by SpiInit and SpiPioInit [Hz]
+ */
+#ifndef SPI_DEFAULT_FREQUENCY
+#define SPI_DEFAULT_FREQUENCY (10 * 1000 * 1000)
+#endif
+
+/*!
+ * \brief Sends a buffer, discarding the received bytes
+ *
+ * \param [IN] obj     SPI object
+ * \param [IN] outData Bytes to send
+ * \param [IN] size    Number of bytes to send
+ */
+void SpiOut(Spi_t *obj, const uint8_t *outData, uint16_t size);
+
+/*!
+ * \brief Receives a buffer while sending 0x00
+ *
+ * \param [IN]  obj    SPI object
+ * \param [OUT] inData Received bytes
+ * \param [IN]  size   Number of bytes to receive
+ */
+void SpiIn(Spi_t *obj, uint8_t *inData, uint16_t size);
+
+/*!
+ * \brief Full-duplex transfer of a buffer
+ *
+ * \param [IN]  obj     SPI object
+ * \param [IN]  outData Bytes to send
+ * \param [OUT] inData  Received bytes
+ * \param [IN]  size    Number of bytes to transfer
+ */
+void SpiTransfer(Spi_t *obj, const uint8_t *outData, uint8_t *inData, uint16_t size);
+
+/*!
+ * Transfers shorter than this many bytes bypass DMA and are sent blocking
+ */
+#ifndef SPI_DMA_MIN_SIZE
+#define SPI_DMA_MIN_SIZE 16
+#endif
+
+/*!
+ * SPI DMA completion callback, called from the DMA IRQ after NSS is released
+ */
+typedef void(SpiDmaCallback)(void *context);
+
+/*!
+ * \brief Sends a buffer through DMA
+ *
+ * The caller asserts obj->Nss before the call. Once the last byte has been
+ * clocked out, obj->Nss is released from the DMA IRQ and callback is called.
+ * Transfers shorter than SPI_DMA_MIN_SIZE complete before this returns.
+ *
+ * \param [IN] obj      SPI object
+ * \param [IN] outData  Bytes to send, must stay valid until completion
+ * \param [IN] size     Number of bytes to send
+ * \param [IN] callback Completion callback, may be NULL
+ * \param [IN] context  Argument passed to callback
+ */
+void SpiOutAsync(Spi_t *obj, const uint8_t *outData, uint16_t size, SpiDmaCallback *callback,
+                 void *context);
+
+/*!
+ * \brief Receives a buffer through DMA while sending 0x00
+ *
+ * Same completion contract as SpiOutAsync.
+ *
+ * \param [IN]  obj      SPI object
+ * \param [OUT] inData   Received bytes, must stay valid until completion
+ * \param [IN]  size     Number of bytes to receive
+ * \param [IN]  callback Completion callback, may be NULL
+ * \param [IN]  context  Argument passed to callback
+ */
+void SpiInAsync(Spi_t *obj, uint8_t *inData, uint16_t size, SpiDmaCallback *callback,
+                void *context);
+
+/*!
+ * \brief Checks if a DMA transfer is in flight
+ *
+ * \retval busy True until the completion callback has run
+ */
+bool SpiIsBusy(Spi_t *obj);
+
+/*!
+ * \brief Waits until the DMA transfer in flight, if any, has completed
+ *
+ * Sleeps with WFE in thread mode. From an IRQ handler the transfer is
+ * polled and completed in place, so the completion callback has run when
+ * this returns in both cases.
+ */
+void SpiWaitIdle(Spi_t *obj);
+
+void SpiGetStats(SpiStats_t *stats);
+
+void SpiResetStats(void);
+
+/*!
+ * Longest time a PIO transaction may take, including its BUSY wait [us]
+ */
+#ifndef SPI_PIO_TIMEOUT_US
+#define SPI_PIO_TIMEOUT_US 100000
+#endif
+
+/*!
+ * \brief Moves an SPI object onto a PIO state machine
+ *
+ * The state machine drives NSS itself and, when busy is not NC, holds each
+ * transaction until BUSY is low. Called after the NSS and BUSY GPIOs have
+ * been initialized, the hardware SPI block is left untouched.
+ *
+ * \param [IN] obj  SPI object
+ * \param [IN] pio  PIO block to load the engine into
+ * \param [IN] mosi SPI MOSI pin name
+ * \param [IN] miso SPI MISO pin name
+ * \param [IN] sclk SPI SCLK pin name
+ * \param [IN] nss  SPI NSS pin name
+ * \param [IN] busy Radio BUSY pin name, NC to leave BUSY to the caller
+ */
+void SpiPioInit(Spi_t *obj, PIO pio, PinNames mosi, PinNames miso, PinNames sclk, PinNames nss,
+                PinNames busy);
+
+bool SpiIsPio(Spi_t *obj);
+
+/*!
+ * \brief Checks if the PIO engine waits on BUSY before each transaction
+ */
+bool SpiPioWaitsOnBusy(Spi_t *obj);
+
+/*!
+ * \brief Runs one NSS framed transaction on the PIO engine
+ *
+ * The header is sent first and overwritten with the bytes received while it
+ * was clocked out, then outData is sent or inData is received.
+ *
+ * \param [IN]     obj        SPI object
+ * \param [IN/OUT] header     Opcode and address bytes
+ * \param [IN]     headerSize Number of header bytes
+ * \param [IN]     outData    Payload to send, NULL to send 0x00
+ * \param [OUT]    inData     Payload received, may be NULL
+ * \param [IN]     size       Payload size
+ * \param [IN]     waitBusy   Hold NSS until BUSY is low
+ * \retval success False if the transaction hit SPI_PIO_TIMEOUT_US
+ */
+bool SpiPioTransfer(Spi_t *obj, uint8_t *header, uint16_t headerSize, const uint8_t *outData,
+                    uint8_t *inData, uint16_t size, bool waitBusy);
+
+/*!
+ * Longest time to wait for the SX126x BUSY line to drop [us]
+ */
+#ifndef SX126X_BUSY_TIMEOUT_US
+#define SX126X_BUSY_TIMEOUT_US 100000
+#endif
+
+/*!
+ * BUSY waits longer than this are slept in WFE instead of spun [us]
+ */
+#ifndef SX126X_BUSY_SPIN_US
+#define SX126X_BUSY_SPIN_US 20
+#endif
+
+/*!
+ * Number of distinct opcodes the BUSY statistics can track
+ */
+#ifndef SX126X_BUSY_STATS_SIZE
+#define SX126X_BUSY_STATS_SIZE 24
+#endif
+
+/*!
+ * BUSY duration statistics of a single SX126x command opcode
+ */
+typedef struct SX126xBusyStats_s {
+  uint8_t Opcode;   //! Command opcode
+  uint32_t Count;   //! Number of BUSY waits after this command
+  uint32_t MinUs;   //! Shortest BUSY duration [us]
+  uint32_t MaxUs;   //! Longest BUSY duration [us]
+  uint64_t TotalUs; //! Sum of the BUSY durations [us], divide by Count for the average
+} SX126xBusyStats_t;
+
+/*!
+ * Pseudo opcode the BUSY time of the boot following a reset is accounted to
+ */
+#define SX126X_BUSY_OPCODE_RESET 0x00
+
+/*!
+ * \brief Gets the BUSY statistics of a command
+ *
+ * \param [IN]  opcode Command opcode, see RadioCommands_t
+ * \param [OUT] stats  Statistics of the command
+ * \retval found False if the command has not been issued since the last reset
+ */
+bool SX126xGetBusyStats(uint8_t opcode, SX126xBusyStats_t *stats);
+
+/*!
+ * \brief Gets the number of BUSY waits that hit SX126X_BUSY_TIMEOUT_US
+ *
+ * \param [OUT] lastOpcode Opcode of the command that last timed out, may be NULL
+ * \retval timeouts Number of timed out waits
+ */
+uint32_t SX126xGetBusyTimeouts(uint8_t *lastOpcode);
+
+void SX126xResetBusyStats(void);
+
+/*!
+ * Time spent in SX126x SPI transactions, from NSS assert to NSS release
+ *
+ * Compare TotalUs / Count with and without the PIO engine to measure its
+ * gain. With its BUSY wait enabled, the PIO figures include time NSS was
+ * held back by BUSY.
+ */
+typedef struct SX126xTransferStats_s {
+  uint32_t Count;   //! Number of transactions
+  uint32_t Bytes;   //! Number of bytes clocked, header included
+  uint64_t TotalUs; //! Sum of the transaction durations [us]
+} SX126xTransferStats_t;
+
+void SX126xGetTransferStats(SX126xTransferStats_t *stats);
+
+void SX126xResetTransferStats(void);
+
+/*!
+ * \brief Gets the number of SPI transactions the board layer avoided
+ *
+ * Counts register reads served from, and unchanged writes absorbed by, the
+ * shadow copies of the SX126x configuration registers, and configuration
+ * commands skipped because their parameters were already applied.
+ *
+ * \retval saved Number of transactions avoided since the last reset
+ */
+uint32_t SX126xGetSavedTransactions(void);
+
+void SX126xResetSavedTransactions(void);
+
+/*!
+ * Power state of the SX126x as tracked by the board layer
+ */
+typedef enum {
+  SX126X_RADIO_COLD,       //! In reset or cold start sleep, configuration and calibration lost
+  SX126X_RADIO_WARM_SLEEP, //! In warm start sleep, configuration and calibration retained
+  SX126X_RADIO_STANDBY,    //! Awake
+} SX126xRadioState_t;
+
+/*!
+ * Wakeup statistics of the SX126x
+ */
+typedef struct SX126xWakeStats_s {
+  uint32_t WarmWakeups;         //! Wakeups from warm start sleep
+  uint32_t ColdWakeups;         //! Wakeups from cold start sleep
+  uint32_t CalibrationsSkipped; //! Calibrate and CalibrateImage commands skipped as still valid
+  uint32_t WakeToTxCount;       //! Number of wakeups followed by SetTx
+  uint32_t LastWakeToTxUs;      //! Time from the last wakeup to SetTx [us]
+  uint32_t MaxWakeToTxUs;       //! Longest time from a wakeup to SetTx [us]
+  uint64_t TotalWakeToTxUs;     //! Sum of the wakeup to SetTx times [us]
+} SX126xWakeStats_t;
+
+SX126xRadioState_t SX126xGetRadioState(void);
+
+/*!
+ * \brief Gets the blocks calibrated since the last cold start
+ *
+ * \retval blocks CalibrationParams_t value of the valid calibrations
+ */
+uint8_t SX126xGetCalibratedBlocks(void);
+
+void SX126xGetWakeStats(SX126xWakeStats_t *stats);
+
+void SX126xResetWakeStats(void);
+
+/*!
+ * \brief Gets the DIO1 timestamps of the last uplink and its receive window
+ *
+ * With every IRQ routed to DIO1, the first edge of an RX window that received
+ * a frame is the preamble detected IRQ.
+ *
+ * \param [OUT] txDoneUs Time of the TX done IRQ [us since boot]
+ * \param [OUT] rxEdgeUs Time of the first IRQ of the last RX window [us since boot]
+ * \retval valid False if no RX edge followed the last TX done
+ */
+bool SX126xGetRxTiming(uint64_t *txDoneUs, uint64_t *rxEdgeUs);
+
+/*!
+ * Emulated EEPROM address of the SPI clock record, past the LoRaMac NVM data
+ */
+#ifndef SX126X_SPI_NVM_ADDRESS
+#define SX126X_SPI_NVM_ADDRESS (FLASH_SECTOR_SIZE - 16)
+#endif
+
+/*!
+ * \brief Finds the fastest SPI clock the radio link carries reliably
+ *
+ * Writes test patterns to the radio data buffer and reads them back at
+ * increasing clock rates. The rate one step below the fastest passing one is
+ * applied and written to the emulated EEPROM, where SX126xLoadSpiFrequency
+ * finds it on the next boot once the caller flushed it. The radio must be
+ * idle in standby, its data buffer is overwritten.
+ *
+ * \retval hz Selected SPI clock [Hz], 0 if even the slowest rate failed
+ */
+uint32_t SX126xCharacterizeSpi(void);
+
+/*!
+ * \brief Applies the SPI clock saved by SX126xCharacterizeSpi
+ *
+ * \retval hz Applied SPI clock [Hz], 0 if no valid record was found
+ */
+uint32_t SX126xLoadSpiFrequency(void);
+
+/*!
+ * Flash sectors at the end of flash holding the NVM journal, split in two
+ * banks that take turns on compaction. Even, and at least 4.
+ */
+#ifndef EEPROM_SECTORS
+#define EEPROM_SECTORS 4
+#endif
+
+/*!
+ * Granularity of the change tracking and of the journal records [bytes]
+ */
+#define EEPROM_CHUNK_SIZE 16
+
+/*!
+ * Serve NVM reads from the XIP mapped flash instead of a RAM mirror. Saves
+ * about 2 KB of RAM with the default overlay: the 4 KB mirror is replaced by
+ * a 512 byte chunk index and the 1.4 KB overlay. Reads that miss the XIP
+ * cache take the flash access time.
+ */
+#ifndef EEPROM_XIP_READS
+#define EEPROM_XIP_READS 0
+#endif
+
+/*!
+ * Chunks that can change between flushes with EEPROM_XIP_READS. A write
+ * that does not fit next to the changes already held flushes them first,
+ * so it lands in flash as a whole as long as it fits the overlay on its
+ * own. The default holds the largest LoRaMac NVM group, region group 2 of
+ * 1.2 KB with the 96 channels of US915, AU915 and CN470. lorawan.c fails
+ * to build with an overlay smaller than any group.
+ */
+#ifndef EEPROM_OVERLAY_CHUNKS
+#define EEPROM_OVERLAY_CHUNKS 80
+#endif
+
+/*!
+ * Longest a sector erase may take [us], the W25Q16JV maximum
+ */
+#ifndef EEPROM_ERASE_GUARD_US
+#define EEPROM_ERASE_GUARD_US 400000
+#endif
+
+/*!
+ * \brief Appends the changes since the last flush to the NVM journal
+ *
+ * Compacts the journal into the other bank when it is full.
+ *
+ * While a page is programmed or a sector erased, no interrupt is serviced,
+ * the radio's DIO1 included. A DIO1 edge is handled once the operation
+ * ends, up to EEPROM_ERASE_GUARD_US later for an erase. Timers do not fire
+ * during the operation either: the RTC alarm IRQ stays enabled, but its
+ * handler only notes a due alarm, and TimerIrqHandler and the timer
+ * callbacks run from flash once the operation ends.
+ *
+ * \retval status LMN_STATUS_OK or LMN_STATUS_ERROR
+ */
+uint8_t EepromMcuFlush(void);
+
+/*!
+ * \brief Flushes like EepromMcuFlush, unless that would erase a sector
+ *        while the RTC alarm is due within EEPROM_ERASE_GUARD_US
+ *
+ * Bounds the erase window against the next armed timer, such as the one
+ * opening an RX window. A refused flush leaves the changes pending, to be
+ * retried later. Programming a page is not bounded, it takes about 0.4 ms.
+ *
+ * \retval status LMN_STATUS_OK, LMN_STATUS_ERROR if refused
+ */
+uint8_t EepromMcuTryFlush(void);
+
+/*!
+ * Called by EepromMcuWriteBuffer before the data is compared with the image,
+ * returns the data to store: data itself or a substitute of the same size
+ */
+typedef const uint8_t *(EepromWriteFilter)(uint16_t addr, const uint8_t *data, uint16_t size);
+
+/*!
+ * \brief Sets the filter applied to EEPROM writes, NULL to remove it
+ */
+void EepromSetWriteFilter(EepromWriteFilter *filter);
+
+/*!
+ * NVM journal counters
+ */
+typedef struct EepromStats_s {
+  uint32_t Flushes;      //! Number of EepromMcuFlush calls that wrote to flash
+  uint32_t Records;      //! Number of records appended
+  uint32_t RecordBytes;  //! Data bytes appended in records
+  uint32_t Compactions;  //! Number of snapshots written to a fresh bank
+  uint32_t SectorErases; //! Number of sectors erased
+  uint32_t Fallbacks;    //! Boots that loaded the older bank because the newest failed its CRC
+  uint64_t BusyUs;       //! Time spent in flushes [us]
+  uint32_t MaxFlushUs;   //! Longest flush [us], interrupts were masked for all of it before flushes yielded
+  uint32_t MaxMaskedUs;  //! Longest time interrupts other than the RTC alarm were masked [us]
+  uint32_t Deferrals;    //! Number of EepromMcuTryFlush calls refused for a due RTC alarm
+} EepromStats_t;
+
+void EepromGetStats(EepromStats_t *stats);
+
+void EepromResetStats(void);
+
+/*!
+ * Number of TimerEvent_t objects that can run at once with the heap timer
+ * engine, see PICO_LORAWAN_HEAP_TIMER in CMakeLists.txt
+ */
+#ifndef TIMER_HEAP_SIZE
+#define TIMER_HEAP_SIZE 64
+#endif
+
+/*!
+ * \brief Sets the RTC alarm to an absolute time, calling TimerIrqHandler then
+ *
+ * Replaces the alarm set by RtcSetAlarm, if any.
+ *
+ * \param [IN] target Alarm time [us since boot]
+ */
+void RtcSetAlarmUs(uint64_t target);
+
+/*!
+ * \brief Gets the time the pending RTC alarm is due
+ *
+ * \retval target Alarm time [us since boot], 0 if no alarm is pending
+ */
+uint64_t RtcGetAlarmTarget(void);
+
+/*!
+ * \brief Gets the IRQ number of the hardware alarm behind the RTC
+ */
+uint RtcGetAlarmIrq(void);
+
+/*!
+ * \brief Defers the RTC alarm while flash is not accessible
+ *
+ * The alarm IRQ handler runs from RAM. While deferring, it acknowledges the
+ * alarm and returns, the alarm is raised again once deferring ends. Timers
+ * due meanwhile fire late, TimerIrqHandler runs from flash.
+ *
+ * \param [IN] defer true to start deferring, false to stop
+ * \retval mask      NVIC mask of the alarm IRQ, which may stay enabled while
+ *                   deferring, 0 before RtcInit
+ */
+uint32_t RtcDeferAlarms(bool defer);
+
+/*!
+ * RTC alarm counters
+ */
+typedef struct RtcAlarmStats_s {
+  uint32_t Scheduled;      //! Number of RtcSetAlarm calls
+  uint32_t Fired;          //! Number of alarms that reached TimerIrqHandler
+  uint32_t LastLatencyUs;  //! Delay from the alarm target to the IRQ handler of the last alarm [us]
+  uint32_t MaxLatencyUs;   //! Longest delay from an alarm target to the IRQ handler [us]
+  uint64_t TotalLatencyUs; //! Sum of the delays [us], divide by Fired for the average
+} RtcAlarmStats_t;
+
+void RtcGetAlarmStats(RtcAlarmStats_t *stats);
+
+void RtcResetAlarmStats(void);
+
+/*!
+ * Maximum number of idle hooks run during delays
+ */
+#ifndef DELAY_IDLE_HOOKS_MAX
+#define DELAY_IDLE_HOOKS_MAX 4
+#endif
+
+/*!
+ * Work run while DelayMs waits, such as sensor warmup or ADC sampling. Hooks
+ * run after every wakeup and must return quickly, a delay called from a
+ * hook busy waits.
+ */
+typedef void (DelayIdleHook)(void *context);
+
+/*!
+ * \brief Registers a hook run while DelayMs waits
+ *
+ * \param [IN] hook    Function to run
+ * \param [IN] context Argument passed to the hook
+ * \retval status      true on success, false if all slots are used
+ */
+bool DelayAddIdleHook(DelayIdleHook *hook, void *context);
+
+/*!
+ * \brief Unregisters a hook added with DelayAddIdleHook
+ */
+void DelayRemoveIdleHook(DelayIdleHook *hook, void *context);
+
+/*!
+ * Delay counters
+ */
+typedef struct DelayStats_s {
+  uint32_t Yielding;   //! Number of delays that slept and ran the idle hooks
+  uint32_t Busy;       //! Number of delays that busy waited, from an IRQ, a hook or with interrupts masked
+  uint64_t YieldingUs; //! Time spent in yielding delays [us]
+  uint64_t BusyUs;     //! Time spent in busy waiting delays [us]
+  uint64_t HookUs;     //! Time spent in idle hooks [us]
+} DelayStats_t;
+
+void DelayGetStats(DelayStats_t *stats);
+
+void DelayResetStats(void);
+
+/*!
+ * Sleeps expected to last longer than this drop clk_sys to the crystal [us]
+ */
+#ifndef BOARD_LOW_POWER_XOSC_MIN_US
+#define BOARD_LOW_POWER_XOSC_MIN_US 2000
+#endif
+
+/*!
+ * Time spent in each power state and the reasons the board woke up
+ */
+typedef struct BoardPowerStats_s {
+  uint64_t ActiveUs;         //! Time running [us]
+  uint64_t SleepUs;          //! Time in WFI at full clock [us]
+  uint64_t LowClockSleepUs;  //! Time in WFI with clk_sys on the crystal [us]
+  uint32_t Sleeps;           //! Number of sleeps at full clock
+  uint32_t LowClockSleeps;   //! Number of sleeps with clk_sys on the crystal
+  uint32_t WakeRtc;          //! Wakeups by the RTC alarm, a MAC timer
+  uint32_t WakeGpio;         //! Wakeups by a GPIO, DIO1 or BUSY of the radio
+  uint32_t WakeTimer;        //! Wakeups by another timer alarm, such as a timeout
+  uint32_t WakeUsb;          //! Wakeups by the USB controller
+  uint32_t WakeOther;        //! Wakeups by any other interrupt
+} BoardPowerStats_t;
+
+/*!
+ * \brief Sleeps until an interrupt is pending or the deadline is reached
+ *
+ * Same as BoardLowPowerHandler, with an extra wakeup at deadline.
+ *
+ * \param [IN] deadline Latest time to wake up
+ */
+void BoardLowPowerHandlerUntil(absolute_time_t deadline);
+
+void BoardGetPowerStats(BoardPowerStats_t *stats);
+
+void BoardResetPowerStats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
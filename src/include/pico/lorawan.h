@@ -13,6 +13,7 @@ extern "C" {
 #endif
 
 #include "hardware/gpio.h"
+#include "hardware/pio.h"
 #include "hardware/spi.h"
 
 #include "LoRaMac.h"
@@ -27,6 +28,23 @@ struct lorawan_sx126x_settings {
   } spi;
   uint reset;
   uint dio1;
+  struct {
+    PIO inst;       // run SPI transactions on this PIO block, NULL for hardware SPI
+    bool wait_busy; // let the PIO engine hold each transaction until BUSY is low
+  } pio;
+};
+
+struct lorawan_sx1276_settings {
+  struct {
+    spi_inst_t *inst;
+    uint mosi;
+    uint miso;
+    uint sck;
+    uint nss;
+  } spi;
+  uint reset;
+  uint dio0;
+  uint dio1;
 };
 
 struct lorawan_abp_settings {
@@ -43,6 +61,41 @@ struct lorawan_otaa_settings {
   const char *channel_mask;
 };
 
+struct lorawan_nvm_stats {
+  uint32_t stores;            // context stores by the MAC
+  uint32_t flushes;           // flushes to flash
+  uint32_t flushes_avoided;   // stores that only changed reserved frame counters or runtime state
+  uint32_t fcnt_reservations; // frame counter blocks reserved
+};
+
+enum lorawan_uplink_status {
+  LORAWAN_UPLINK_SENT,      // transmitted, and acknowledged when confirmed
+  LORAWAN_UPLINK_NOT_ACKED, // confirmed uplink transmitted without acknowledgement
+  LORAWAN_UPLINK_FAILED,    // transmission failed
+  LORAWAN_UPLINK_EXPIRED,   // not sent before its expiry
+  LORAWAN_UPLINK_TOO_LONG,  // does not fit the current datarate
+};
+
+struct lorawan_uplink {
+  const void *data;
+  uint8_t data_len;
+  uint8_t app_port;
+  bool confirmed;
+  uint8_t priority;   // higher priorities are sent first
+  uint32_t expiry_ms; // dropped when not sent within this time, 0 to never expire
+  void (*callback)(enum lorawan_uplink_status status, void *context); // may be NULL
+  void *context;
+};
+
+struct lorawan_downlink {
+  const uint8_t *data;
+  uint8_t data_len;
+  uint8_t app_port;
+  int16_t rssi;          // [dBm]
+  int8_t snr;            // [dB]
+  uint64_t timestamp_us; // reception time since boot
+};
+
 const char *lorawan_default_dev_eui(char *dev_eui);
 
 int lorawan_init(const struct lorawan_sx126x_settings *sx126x_settings, LoRaMacRegion_t region);
@@ -53,6 +106,22 @@ int lorawan_init_abp(const struct lorawan_sx126x_settings *sx126x_settings, LoRa
 int lorawan_init_otaa(const struct lorawan_sx126x_settings *sx126x_settings, LoRaMacRegion_t region,
                       const struct lorawan_otaa_settings *otaa_settings);
 
+// Finds the fastest reliable SPI clock for the SX126x and saves it for the next boots
+// along with the next NVM flush, call while the radio is idle
+int lorawan_characterize_spi(uint32_t *frequency);
+
+// SX1276 variants, available when linking pico_lorawan_sx1276 instead of pico_lorawan
+
+int lorawan_init_sx1276(const struct lorawan_sx1276_settings *sx1276_settings,
+                        LoRaMacRegion_t region);
+
+int lorawan_init_sx1276_abp(const struct lorawan_sx1276_settings *sx1276_settings,
+                            LoRaMacRegion_t region, const struct lorawan_abp_settings *abp_settings);
+
+int lorawan_init_sx1276_otaa(const struct lorawan_sx1276_settings *sx1276_settings,
+                             LoRaMacRegion_t region,
+                             const struct lorawan_otaa_settings *otaa_settings);
+
 int lorawan_join();
 
 int lorawan_is_joined();
@@ -63,12 +132,42 @@ int lorawan_process_timeout_ms(uint32_t timeout_ms);
 
 int lorawan_send_unconfirmed(const void *data, uint8_t data_len, uint8_t app_port);
 
+// Copies the uplink into the queue, lorawan_process sends it once the MAC and the duty
+// cycle allow
+int lorawan_queue_uplink(const struct lorawan_uplink *uplink);
+
+int lorawan_uplinks_queued();
+
 int lorawan_receive(void *data, uint8_t data_len, uint8_t *app_port);
 
+// Oldest received downlink without copying it, NULL when none is pending. It stays valid
+// until lorawan_release_downlink is called.
+const struct lorawan_downlink *lorawan_peek_downlink();
+
+void lorawan_release_downlink();
+
+// Downlinks dropped because LORAWAN_DOWNLINK_QUEUE_SIZE were already pending
+uint32_t lorawan_get_downlink_drops();
+
 void lorawan_debug(bool debug);
 
+// Writes NVM changes to flash now, they are otherwise flushed once the radio is idle. Returns
+// -1 and keeps them pending when an erase would delay a timer that is about to fire.
+int lorawan_flush_nvm();
+
 int lorawan_erase_nvm();
 
+void lorawan_get_nvm_stats(struct lorawan_nvm_stats *stats);
+
+uint32_t lorawan_get_max_rx_error();
+
+// Requests the network time through the clock synchronization package, sends an uplink
+int lorawan_request_time();
+
+// Network time as seconds since the GPS epoch, returns -1 and the time since boot
+// until the network time has been received
+int lorawan_get_time(uint32_t *gps_seconds, uint16_t *milliseconds);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * NVM flush scheduling, see lorawan-nvm.h.
+ */
+
+#include "pico/lorawan.h"
+
+#include "pico/board-rp2040.h"
+#include "pico/time.h"
+#include "utilities.h"
+
+#include "lorawan-nvm.h"
+#include "lorawan-radio.h"
+
+/*!
+ * Quiet time after the last NVM change before the changes are flushed [ms]
+ */
+#ifndef LORAWAN_NVM_FLUSH_DELAY_MS
+#define LORAWAN_NVM_FLUSH_DELAY_MS 100
+#endif
+
+/*!
+ * Longest time NVM changes wait for the radio to become idle [ms]
+ */
+#ifndef LORAWAN_NVM_FLUSH_MAX_DELAY_MS
+#define LORAWAN_NVM_FLUSH_MAX_DELAY_MS 10000
+#endif
+
+/*!
+ * NVM changes waiting to be flushed
+ */
+static struct {
+  bool Pending;
+  bool Reserved;         // A reserved frame counter block waits for its flush
+  uint32_t FCntLimit;    // Last frame counter the block in flash covers while Reserved
+  absolute_time_t First; // Oldest unflushed change
+  absolute_time_t Last;  // Newest unflushed change
+} NvmFlush;
+
+static struct lorawan_nvm_stats NvmStats;
+
+/*!
+ * \brief Schedules a flush of the changes written to the EEPROM cache
+ */
+static void NvmFlushRequest(void) {
+  absolute_time_t now = get_absolute_time();
+
+  if (!NvmFlush.Pending) {
+    NvmFlush.Pending = true;
+    NvmFlush.First = now;
+  }
+  NvmFlush.Last = now;
+}
+
+int lorawan_nvm_flush(bool guard) {
+  if ((guard ? EepromMcuTryFlush() : EepromMcuFlush()) != LMN_STATUS_OK) {
+    if (!NvmFlush.Pending) {
+      NvmFlushRequest();
+    }
+    return -1;
+  }
+
+  NvmFlush.Pending = false;
+  NvmFlush.Reserved = false;
+  NvmStats.flushes++;
+
+  return 0;
+}
+
+void lorawan_nvm_reserved(uint32_t stored_fcnt) {
+  NvmStats.fcnt_reservations++;
+
+  // A block reserved before is still only in RAM, flash holds the older one
+  if (!NvmFlush.Reserved) {
+    NvmFlush.Reserved = true;
+    NvmFlush.FCntLimit = stored_fcnt;
+  }
+}
+
+void lorawan_nvm_stored(uint32_t fcnt, bool changed) {
+  NvmStats.stores++;
+
+  // A new frame counter block is flushed right away, unless an erase would
+  // hold back a due timer. Deferring stops once the next frame would take a
+  // counter past the block in flash, that flush is forced.
+  if (NvmFlush.Reserved) {
+    lorawan_nvm_flush(fcnt < NvmFlush.FCntLimit);
+    return;
+  }
+
+  if (!changed) {
+    // Only reserved frame counters or runtime state changed
+    NvmStats.flushes_avoided++;
+    return;
+  }
+
+  NvmFlushRequest();
+}
+
+/*!
+ * Flash operations stall the CPU, so they wait for the MAC to be idle, which
+ * means no RX window is due, and for the radio to be idle. Changes are
+ * batched until LORAWAN_NVM_FLUSH_DELAY_MS passed without a new one, or the
+ * board is about to sleep. After LORAWAN_NVM_FLUSH_MAX_DELAY_MS the radio may
+ * be receiving, as it always is in class C. A flush that would erase flash
+ * while a timer is due is retried on a later call.
+ *
+ * The flush before sleep is skipped while the MAC is busy or the erase
+ * guard refuses. Both mean a timer wakes the board soon, for an RX window
+ * or within the guard time, and the next call retries. A forced flush
+ * would stall the CPU through that timer, so the changes stay in RAM for
+ * the short sleep. A reset during it loses at most the runtime state, the
+ * frame counter block in flash still covers the next frame.
+ */
+void lorawan_nvm_process(bool before_sleep, bool mac_busy, bool radio_idle) {
+  if (!NvmFlush.Pending || mac_busy) {
+    return;
+  }
+
+  absolute_time_t now = get_absolute_time();
+  bool quiet = absolute_time_diff_us(NvmFlush.Last, now) >= (LORAWAN_NVM_FLUSH_DELAY_MS * 1000);
+  bool overdue = absolute_time_diff_us(NvmFlush.First, now) >= (LORAWAN_NVM_FLUSH_MAX_DELAY_MS * 1000);
+
+  if ((radio_idle && (quiet || before_sleep)) || overdue) {
+    lorawan_nvm_flush(true);
+  }
+}
+
+int lorawan_flush_nvm() { return lorawan_nvm_flush(true); }
+
+void lorawan_nvm_changed() { NvmFlushRequest(); }
+
+void lorawan_get_nvm_stats(struct lorawan_nvm_stats *stats) { *stats = NvmStats; }
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * NVM flush scheduling of lorawan.c. Changes written to the emulated EEPROM
+ * are batched and flushed once flash stalls are harmless, new frame counter
+ * blocks as soon as no timer is about to fire.
+ */
+
+#ifndef _LORAWAN_NVM_H_
+#define _LORAWAN_NVM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A store reserved a new frame counter block, flash still holds the block
+// ending at stored_fcnt until the next flush
+void lorawan_nvm_reserved(uint32_t stored_fcnt);
+
+// Called after every store of the MAC context, fcnt is the last frame
+// counter used and changed is set when data that must be kept changed
+void lorawan_nvm_stored(uint32_t fcnt, bool changed);
+
+// Flushes right away, with guard set no erase starts while a timer is due
+// and the changes stay pending, returns 0 on success
+int lorawan_nvm_flush(bool guard);
+
+// Flushes the pending changes when flash stalls are harmless, call from the
+// main loop
+void lorawan_nvm_process(bool before_sleep, bool mac_busy, bool radio_idle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
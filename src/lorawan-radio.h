@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Interface between lorawan.c and the radio backends. Each backend is built
+ * into its own library together with its LoRaMac-node driver, so an image
+ * only carries the radio it was linked against.
+ */
+
+#ifndef _LORAWAN_RADIO_H_
+#define _LORAWAN_RADIO_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pico/lorawan.h"
+
+struct lorawan_radio_backend {
+  // Sets up the SPI bus and GPIOs of the radio from its settings struct,
+  // returns 0 on success
+  int (*io_init)(const void *radio_settings);
+
+  // Gets the time of the last TX done and of the first IRQ of the RX window
+  // that followed it, the preamble detection, NULL if the radio can't tell
+  bool (*get_rx_timing)(uint64_t *tx_done_us, uint64_t *rx_edge_us);
+};
+
+void lorawan_set_activation(const struct lorawan_abp_settings *abp_settings,
+                            const struct lorawan_otaa_settings *otaa_settings);
+
+// Schedules a flush of data the backend wrote to the EEPROM outside of
+// LoRaMac, it is written along with the next NVM flush
+void lorawan_nvm_changed();
+
+int lorawan_init_radio(const struct lorawan_radio_backend *backend, const void *radio_settings,
+                       LoRaMacRegion_t region);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
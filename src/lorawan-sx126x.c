@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * SX126x radio backend.
+ */
+
+#include "pico/lorawan.h"
+
+#include "pico/board-rp2040.h"
+#include "radio.h"
+#include "sx126x-board.h"
+
+#include "lorawan-radio.h"
+
+static int sx126x_io_init(const void *radio_settings) {
+  const struct lorawan_sx126x_settings *sx126x_settings = radio_settings;
+
+  SpiInit(&SX126x.Spi, (SpiId_t)((sx126x_settings->spi.inst == spi0) ? 0 : 1),
+          sx126x_settings->spi.mosi, sx126x_settings->spi.miso, sx126x_settings->spi.sck, NC);
+
+  SX126x.Spi.Nss.pin = sx126x_settings->spi.nss;
+  SX126x.Reset.pin = sx126x_settings->reset;
+  SX126x.DIO1.pin = sx126x_settings->dio1;
+
+  SX126xIoInit();
+
+  // The PIO engine takes NSS over from the GPIO set up above
+  if (sx126x_settings->pio.inst != NULL) {
+    SpiPioInit(&SX126x.Spi, sx126x_settings->pio.inst, sx126x_settings->spi.mosi,
+               sx126x_settings->spi.miso, sx126x_settings->spi.sck, sx126x_settings->spi.nss,
+               sx126x_settings->pio.wait_busy ? SX126x.BUSY.pin : NC);
+  }
+
+  // Use the clock found by lorawan_characterize_spi() on a previous boot
+  SX126xLoadSpiFrequency();
+
+  return 0;
+}
+
+static const struct lorawan_radio_backend Sx126xBackend = {
+    .io_init = sx126x_io_init,
+    .get_rx_timing = SX126xGetRxTiming,
+};
+
+int lorawan_init(const struct lorawan_sx126x_settings *sx126x_settings, LoRaMacRegion_t region) {
+  return lorawan_init_radio(&Sx126xBackend, sx126x_settings, region);
+}
+
+int lorawan_init_abp(const struct lorawan_sx126x_settings *sx126x_settings, LoRaMacRegion_t region,
+                     const struct lorawan_abp_settings *abp_settings) {
+  lorawan_set_activation(abp_settings, NULL);
+
+  return lorawan_init(sx126x_settings, region);
+}
+
+int lorawan_init_otaa(const struct lorawan_sx126x_settings *sx126x_settings, LoRaMacRegion_t region,
+                      const struct lorawan_otaa_settings *otaa_settings) {
+  lorawan_set_activation(NULL, otaa_settings);
+
+  return lorawan_init(sx126x_settings, region);
+}
+
+int lorawan_characterize_spi(uint32_t *frequency) {
+  Radio.Standby();
+
+  uint32_t hz = SX126xCharacterizeSpi();
+
+  if (hz != 0) {
+    lorawan_nvm_changed();
+  }
+
+  if (frequency != NULL) {
+    *frequency = hz;
+  }
+
+  return (hz != 0) ? 0 : -1;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * SX1276 radio backend.
+ */
+
+#include "pico/lorawan.h"
+
+#include "sx1276-board.h"
+
+#include "lorawan-radio.h"
+
+static int sx1276_io_init(const void *radio_settings) {
+  const struct lorawan_sx1276_settings *sx1276_settings = radio_settings;
+
+  SpiInit(&SX1276.Spi, (SpiId_t)((sx1276_settings->spi.inst == spi0) ? 0 : 1),
+          sx1276_settings->spi.mosi, sx1276_settings->spi.miso, sx1276_settings->spi.sck, NC);
+
+  SX1276.Spi.Nss.pin = sx1276_settings->spi.nss;
+  SX1276.Reset.pin = sx1276_settings->reset;
+  SX1276.DIO0.pin = sx1276_settings->dio0;
+  SX1276.DIO1.pin = sx1276_settings->dio1;
+
+  SX1276IoInit();
+
+  // check version register
+  if (SX1276Read(REG_LR_VERSION) != 0x12) {
+    return -1;
+  }
+
+  return 0;
+}
+
+static const struct lorawan_radio_backend Sx1276Backend = {
+    .io_init = sx1276_io_init,
+    .get_rx_timing = NULL,
+};
+
+int lorawan_init_sx1276(const struct lorawan_sx1276_settings *sx1276_settings,
+                        LoRaMacRegion_t region) {
+  return lorawan_init_radio(&Sx1276Backend, sx1276_settings, region);
+}
+
+int lorawan_init_sx1276_abp(const struct lorawan_sx1276_settings *sx1276_settings,
+                            LoRaMacRegion_t region, const struct lorawan_abp_settings *abp_settings) {
+  lorawan_set_activation(abp_settings, NULL);
+
+  return lorawan_init_sx1276(sx1276_settings, region);
+}
+
+int lorawan_init_sx1276_otaa(const struct lorawan_sx1276_settings *sx1276_settings,
+                             LoRaMacRegion_t region,
+                             const struct lorawan_otaa_settings *otaa_settings) {
+  lorawan_set_activation(NULL, otaa_settings);
+
+  return lorawan_init_sx1276(sx1276_settings, region);
+}
@@ -24,24 +24,34 @@
  *
  */
 
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "hardware/sync.h"
 #include "pico/lorawan.h"
 #include "pico/time.h"
 
 #include "board.h"
 #include "rtc-board.h"
-// #include "sx1276-board.h"
-#include "sx126x-board.h"
+#include "pico/board-rp2040.h"
 
 #include "../../periodic-uplink-lpp/firmwareVersion.h"
 #include "Commissioning.h"
 #include "LmHandler.h"
 #include "LmHandlerMsgDisplay.h"
+#include "LmhpClockSync.h"
 #include "LmhpCompliance.h"
 #include "NvmDataMgmt.h"
 #include "RegionCommon.h"
+#include "radio.h"
+#include "systime.h"
+#include "timer.h"
+#include "utilities.h"
+
+#include "lorawan-nvm.h"
+#include "lorawan-radio.h"
 
 /*!
  * LoRaWAN default end-device class
@@ -84,6 +94,75 @@
  */
 #define LORAWAN_PUBLIC_NETWORK true
 
+/*!
+ * Frame counters reserved per NVM write. The stored FCntUp runs ahead of the
+ * last used one by half to all of this, so uplinks within the block leave
+ * flash alone. After a reset the rest of the block is skipped, keep it well
+ * below the network server's maximum frame counter gap.
+ */
+#ifndef LORAWAN_FCNT_RESERVATION
+#define LORAWAN_FCNT_RESERVATION 64
+#endif
+
+/*!
+ * NVM layout of NvmDataMgmt, which stores the groups back to back
+ */
+#define NVM_GROUP_SIZE(group) sizeof(((LoRaMacNvmData_t *)0)->group)
+#define NVM_CRYPTO_OFFSET 0
+#define NVM_MAC_GROUP1_OFFSET (NVM_CRYPTO_OFFSET + NVM_GROUP_SIZE(Crypto))
+#define NVM_MAC_GROUP2_OFFSET (NVM_MAC_GROUP1_OFFSET + NVM_GROUP_SIZE(MacGroup1))
+#define NVM_SECURE_ELEMENT_OFFSET (NVM_MAC_GROUP2_OFFSET + NVM_GROUP_SIZE(MacGroup2))
+#define NVM_REGION_GROUP1_OFFSET (NVM_SECURE_ELEMENT_OFFSET + NVM_GROUP_SIZE(SecureElement))
+
+#if EEPROM_XIP_READS
+// Chunks a group spans at worst, a group larger than the overlay would not
+// be written atomically
+#define NVM_GROUP_CHUNKS(group) ((NVM_GROUP_SIZE(group) + 2 * EEPROM_CHUNK_SIZE - 2) / EEPROM_CHUNK_SIZE)
+#define NVM_GROUP_FITS(group) (NVM_GROUP_CHUNKS(group) <= EEPROM_OVERLAY_CHUNKS)
+
+_Static_assert(NVM_GROUP_FITS(Crypto) && NVM_GROUP_FITS(MacGroup1) && NVM_GROUP_FITS(MacGroup2) &&
+                   NVM_GROUP_FITS(SecureElement) && NVM_GROUP_FITS(RegionGroup1) && NVM_GROUP_FITS(RegionGroup2),
+               "EEPROM_OVERLAY_CHUNKS is too small for the LoRaMac NVM groups");
+#endif
+
+/*!
+ * Number of uplinks lorawan_queue_uplink can hold
+ */
+#ifndef LORAWAN_UPLINK_QUEUE_SIZE
+#define LORAWAN_UPLINK_QUEUE_SIZE 8
+#endif
+
+/*!
+ * Number of received downlinks held until the application reads them, a
+ * power of two
+ */
+#ifndef LORAWAN_DOWNLINK_QUEUE_SIZE
+#define LORAWAN_DOWNLINK_QUEUE_SIZE 4
+#endif
+
+#if (LORAWAN_DOWNLINK_QUEUE_SIZE & (LORAWAN_DOWNLINK_QUEUE_SIZE - 1)) != 0
+#error "LORAWAN_DOWNLINK_QUEUE_SIZE must be a power of two"
+#endif
+
+/*!
+ * RX window error used until enough downlinks have been timed [ms]
+ */
+#define LORAWAN_RX_ERROR_DEFAULT_MS 20
+
+/*!
+ * Smallest RX window error the calibration may set [ms]
+ */
+#ifndef LORAWAN_RX_ERROR_FLOOR_MS
+#define LORAWAN_RX_ERROR_FLOOR_MS 3
+#endif
+
+/*!
+ * Number of timed downlinks needed before the RX window error is adjusted
+ */
+#ifndef LORAWAN_RX_ERROR_MIN_SAMPLES
+#define LORAWAN_RX_ERROR_MIN_SAMPLES 8
+#endif
+
 /*!
  * User application data
  */
@@ -167,18 +246,260 @@ static const struct lorawan_abp_settings *AbpSettings = NULL;
 
 static const struct lorawan_otaa_settings *OtaaSettings = NULL;
 
-static uint8_t AppRxDataBuffer[LORAWAN_APP_DATA_BUFFER_MAX_SIZE];
-
-static LmHandlerAppData_t AppRxData = {
-    .Buffer = AppRxDataBuffer,
-    .BufferSize = 0,
-    .Port = 0,
-};
+/*!
+ * Received downlinks, a single producer single consumer ring. OnRxData only
+ * advances Head and the application only advances Tail, both run freely and
+ * wrap.
+ */
+static struct {
+  struct {
+    struct lorawan_downlink Info;
+    uint8_t Buffer[LORAWAN_APP_DATA_BUFFER_MAX_SIZE];
+  } Entries[LORAWAN_DOWNLINK_QUEUE_SIZE];
+  volatile uint32_t Head;
+  volatile uint32_t Tail;
+  volatile uint32_t Drops; // Downlinks lost to a full ring
+} Downlinks;
 
 static bool Debug = false;
 
+/*!
+ * NVM writes since the last store
+ */
+static struct {
+  bool Changed;  // A write changed data that must be kept
+  uint32_t FCnt; // Last frame counter used
+} NvmWrites;
+
+/*!
+ * Uplinks waiting for the MAC, sent by priority and then in queueing order
+ */
+static struct {
+  struct {
+    bool Used;
+    bool Confirmed;
+    uint8_t Port;
+    uint8_t Priority;
+    uint8_t Size;
+    uint32_t Seq;
+    absolute_time_t Expiry;
+    void (*Callback)(enum lorawan_uplink_status status, void *context);
+    void *Context;
+    uint8_t Buffer[LORAWAN_APP_DATA_BUFFER_MAX_SIZE];
+  } Entries[LORAWAN_UPLINK_QUEUE_SIZE];
+  int InFlight; // Entry waiting for its MCPS confirm, -1 if none
+  uint32_t Seq;
+  absolute_time_t NextTx; // End of the duty cycle restriction
+  TimerEvent_t Timer;     // Wakes the board for the next attempt or expiry
+} UplinkQueue = {.InFlight = -1};
+
+static const struct lorawan_radio_backend *RadioBackend = NULL;
+
+/*!
+ * Downlink timing estimator, in the style of the TCP round trip estimator
+ *
+ * The offset of a frame is the time from TX done to its preamble detection,
+ * minus the receive delay of its window. Per datarate, Baseline tracks the
+ * mean offset, which absorbs the datarate's preamble detection latency.
+ * Deviation tracks the mean distance to the baseline over all datarates,
+ * which is the timing error the RX windows have to cover.
+ */
+static struct {
+  int32_t Baseline[16]; // [us]
+  uint32_t BaselineSamples[16];
+  uint32_t Deviation; // [us]
+  uint32_t Samples;
+  uint32_t MaxRxError; // [ms]
+} RxTiming = {.MaxRxError = LORAWAN_RX_ERROR_DEFAULT_MS};
+
 extern void EepromMcuInit();
 extern uint8_t EepromMcuFlush();
+extern uint8_t EepromMcuTryFlush();
+extern uint8_t EepromMcuReadBuffer(uint16_t addr, uint8_t *buffer, uint16_t size);
+
+static void UplinkComplete(int index, enum lorawan_uplink_status status) {
+  void (*callback)(enum lorawan_uplink_status status, void *context) =
+      UplinkQueue.Entries[index].Callback;
+  void *context = UplinkQueue.Entries[index].Context;
+
+  // Freed first, the callback may queue the next uplink
+  UplinkQueue.Entries[index].Used = false;
+
+  if (callback != NULL) {
+    callback(status, context);
+  }
+}
+
+/*!
+ * \brief Wakes the board when the duty cycle allows the next uplink or the
+ *        next queued uplink expires
+ */
+static void UplinkQueueArm(void) {
+  absolute_time_t wake = at_the_end_of_time;
+  absolute_time_t now = get_absolute_time();
+
+  TimerStop(&UplinkQueue.Timer);
+
+  for (int i = 0; i < LORAWAN_UPLINK_QUEUE_SIZE; i++) {
+    if (UplinkQueue.Entries[i].Used && (i != UplinkQueue.InFlight) &&
+        (absolute_time_diff_us(UplinkQueue.Entries[i].Expiry, wake) > 0)) {
+      wake = UplinkQueue.Entries[i].Expiry;
+    }
+  }
+
+  if ((absolute_time_diff_us(now, UplinkQueue.NextTx) > 0) &&
+      (absolute_time_diff_us(UplinkQueue.NextTx, wake) > 0)) {
+    wake = UplinkQueue.NextTx;
+  }
+
+  if (is_at_the_end_of_time(wake)) {
+    return;
+  }
+
+  int64_t wait_us = absolute_time_diff_us(now, wake);
+
+  TimerSetValue(&UplinkQueue.Timer, (wait_us > 0) ? (uint32_t)((wait_us + 999) / 1000) : 1);
+  TimerStart(&UplinkQueue.Timer);
+}
+
+static void OnUplinkTimerEvent(void *context) { IsMacProcessPending = 1; }
+
+/*!
+ * \brief Sends the next queued uplink once the MAC and the duty cycle allow
+ */
+static void UplinkQueueProcess(void) {
+  absolute_time_t now = get_absolute_time();
+  int next = -1;
+
+  for (int i = 0; i < LORAWAN_UPLINK_QUEUE_SIZE; i++) {
+    if (!UplinkQueue.Entries[i].Used || (i == UplinkQueue.InFlight)) {
+      continue;
+    }
+
+    if (time_reached(UplinkQueue.Entries[i].Expiry)) {
+      UplinkComplete(i, LORAWAN_UPLINK_EXPIRED);
+      continue;
+    }
+
+    if ((next < 0) || (UplinkQueue.Entries[i].Priority > UplinkQueue.Entries[next].Priority) ||
+        ((UplinkQueue.Entries[i].Priority == UplinkQueue.Entries[next].Priority) &&
+         ((int32_t)(UplinkQueue.Entries[i].Seq - UplinkQueue.Entries[next].Seq) < 0))) {
+      next = i;
+    }
+  }
+
+  if ((next < 0) || (UplinkQueue.InFlight >= 0) || !lorawan_is_joined() || LmHandlerIsBusy() ||
+      (absolute_time_diff_us(now, UplinkQueue.NextTx) > 0)) {
+    UplinkQueueArm();
+    return;
+  }
+
+  LoRaMacTxInfo_t txInfo = {0};
+  LoRaMacStatus_t txPossible = LoRaMacQueryTxPossible(UplinkQueue.Entries[next].Size, &txInfo);
+
+  // Too long for the datarate even without MAC commands
+  if ((txPossible == LORAMAC_STATUS_LENGTH_ERROR) &&
+      (UplinkQueue.Entries[next].Size > txInfo.CurrentPossiblePayloadSize)) {
+    UplinkComplete(next, LORAWAN_UPLINK_TOO_LONG);
+    IsMacProcessPending = 1;
+    return;
+  }
+
+  LmHandlerAppData_t appData = {
+      .Buffer = UplinkQueue.Entries[next].Buffer,
+      .BufferSize = UplinkQueue.Entries[next].Size,
+      .Port = UplinkQueue.Entries[next].Port,
+  };
+
+  // A duty cycle restriction is reported through OnMacMcpsRequest, the entry
+  // then stays queued until NextTx. When pending MAC commands leave no room
+  // for the payload, LmHandlerSend sends them in an empty frame instead, and
+  // the entry stays queued for the next attempt.
+  if ((LmHandlerSend(&appData, UplinkQueue.Entries[next].Confirmed ? LORAMAC_HANDLER_CONFIRMED_MSG
+                                                                   : LORAMAC_HANDLER_UNCONFIRMED_MSG) ==
+       LORAMAC_HANDLER_SUCCESS) &&
+      (txPossible == LORAMAC_STATUS_OK)) {
+    UplinkQueue.InFlight = next;
+  }
+
+  UplinkQueueArm();
+}
+
+/*!
+ * \brief Stores the crypto group with FCntUp at the end of a reserved block
+ *
+ * The stored FCntUp stays put while the used one is within the first half
+ * of the block, so the stored group only changes every half block. A new
+ * block is reserved with half of the old one left: frames the MAC sends
+ * before its next store use counters the stored block still covers, the
+ * new block is flushed before a frame would need it.
+ */
+static const uint8_t *NvmReserveFCnt(const uint8_t *data) {
+  static LoRaMacCryptoNvmData_t crypto;
+  uint32_t reserved;
+
+  memcpy(&crypto, data, sizeof(crypto));
+
+  EepromMcuReadBuffer(NVM_CRYPTO_OFFSET + offsetof(LoRaMacCryptoNvmData_t, FCntList.FCntUp),
+                      (uint8_t *)&reserved, sizeof(reserved));
+
+  uint32_t fcnt = crypto.FCntList.FCntUp;
+
+  NvmWrites.FCnt = fcnt;
+
+  if ((fcnt < reserved) && ((reserved - fcnt) > (LORAWAN_FCNT_RESERVATION / 2)) &&
+      ((reserved - fcnt) <= LORAWAN_FCNT_RESERVATION)) {
+    crypto.FCntList.FCntUp = reserved;
+  } else if (fcnt <= (UINT32_MAX - LORAWAN_FCNT_RESERVATION)) {
+    crypto.FCntList.FCntUp = fcnt + LORAWAN_FCNT_RESERVATION;
+    lorawan_nvm_reserved(reserved);
+  }
+
+  // Checked by NvmDataMgmtRestore, computed the way LoRaMac does
+  crypto.Crc32 = Crc32((uint8_t *)&crypto, sizeof(crypto) - sizeof(crypto.Crc32));
+
+  return (const uint8_t *)&crypto;
+}
+
+static bool NvmDiffers(uint16_t addr, const uint8_t *data, uint16_t size) {
+  uint8_t stored[16];
+
+  for (uint16_t i = 0; i < size; i += sizeof(stored)) {
+    uint16_t n = MIN(sizeof(stored), size - i);
+
+    EepromMcuReadBuffer(addr + i, stored, n);
+
+    if (memcmp(stored, data + i, n) != 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/*!
+ * \brief Filters the NVM groups written by NvmDataMgmtStore
+ *
+ * Uplinks change the frame counter and the runtime state in MAC and region
+ * group 1, such as the duty cycle timing and the ADR ack counter. The
+ * frame counter is reserved in blocks, the runtime state is written along
+ * with the next flush, losing it on a reset is harmless. Any other change
+ * requests a flush.
+ */
+static const uint8_t *NvmWriteFilter(uint16_t addr, const uint8_t *data, uint16_t size) {
+  if ((addr == NVM_CRYPTO_OFFSET) && (size == NVM_GROUP_SIZE(Crypto))) {
+    data = NvmReserveFCnt(data);
+  } else if (((addr == NVM_MAC_GROUP1_OFFSET) && (size == NVM_GROUP_SIZE(MacGroup1))) ||
+             ((addr == NVM_REGION_GROUP1_OFFSET) && (size == NVM_GROUP_SIZE(RegionGroup1)))) {
+    return data;
+  }
+
+  if (NvmDiffers(addr, data, size)) {
+    NvmWrites.Changed = true;
+  }
+
+  return data;
+}
 
 const char *lorawan_default_dev_eui(char *dev_eui) {
   uint8_t boardId[8];
@@ -191,24 +512,26 @@ const char *lorawan_default_dev_eui(char *dev_eui) {
   return dev_eui;
 }
 
-int lorawan_init(const struct lorawan_sx126x_settings *sx126x_settings, LoRaMacRegion_t region) {
+void lorawan_set_activation(const struct lorawan_abp_settings *abp_settings,
+                            const struct lorawan_otaa_settings *otaa_settings) {
+  AbpSettings = abp_settings;
+  OtaaSettings = otaa_settings;
+}
+
+int lorawan_init_radio(const struct lorawan_radio_backend *backend, const void *radio_settings,
+                       LoRaMacRegion_t region) {
   EepromMcuInit();
+  EepromSetWriteFilter(NvmWriteFilter);
 
-  RtcInit();
-  SpiInit(&SX126x.Spi, (SpiId_t)((sx126x_settings->spi.inst == spi0) ? 0 : 1),
-          sx126x_settings->spi.mosi, sx126x_settings->spi.miso, sx126x_settings->spi.sck, NC);
+  TimerInit(&UplinkQueue.Timer, OnUplinkTimerEvent);
 
-  SX126x.Spi.Nss.pin = sx126x_settings->spi.nss;
-  SX126x.Reset.pin = sx126x_settings->reset;
-  // SX126x.DIO0.pin = sx1276_settings->dio0;
-  SX126x.DIO1.pin = sx126x_settings->dio1;
+  RtcInit();
 
-  SX126xIoInit();
+  RadioBackend = backend;
 
-  // check version register
-  // if (SX1276Read(REG_LR_VERSION) != 0x12) {
-  //   return -1;
-  // }
+  if (backend->io_init(radio_settings) != 0) {
+    return -1;
+  }
 
   LmHandlerParams.Region = region;
 
@@ -216,30 +539,18 @@ int lorawan_init(const struct lorawan_sx126x_settings *sx126x_settings, LoRaMacR
     return -1;
   }
 
-  // Set system maximum tolerated rx error in milliseconds
-  LmHandlerSetSystemMaxRxError(20);
+  // Set system maximum tolerated rx error in milliseconds, until downlinks
+  // have been timed
+  LmHandlerSetSystemMaxRxError(RxTiming.MaxRxError);
 
   // The LoRa-Alliance Compliance protocol package should always be
   // initialized and activated.
   LmHandlerPackageRegister(PACKAGE_ID_COMPLIANCE, &LmhpComplianceParams);
 
-  return 0;
-}
-
-int lorawan_init_abp(const struct lorawan_sx126x_settings *sx126x_settings, LoRaMacRegion_t region,
-                     const struct lorawan_abp_settings *abp_settings) {
-  AbpSettings = abp_settings;
-  OtaaSettings = NULL;
-
-  return lorawan_init(sx126x_settings, region);
-}
+  // Answers the network time server, applies AppTimeAns corrections to SysTime
+  LmHandlerPackageRegister(PACKAGE_ID_CLOCK_SYNC, NULL);
 
-int lorawan_init_otaa(const struct lorawan_sx126x_settings *sx126x_settings, LoRaMacRegion_t region,
-                      const struct lorawan_otaa_settings *otaa_settings) {
-  AbpSettings = NULL;
-  OtaaSettings = otaa_settings;
-
-  return lorawan_init(sx126x_settings, region);
+  return 0;
 }
 
 int lorawan_join() {
@@ -256,6 +567,10 @@ int lorawan_process() {
   // Processes the LoRaMac events
   LmHandlerProcess();
 
+  UplinkQueueProcess();
+
+  lorawan_nvm_process(false, LmHandlerIsBusy(), Radio.GetStatus() == RF_IDLE);
+
   CRITICAL_SECTION_BEGIN();
   if (IsMacProcessPending == 1) {
     // Clear flag and prevent MCU to go into low power modes.
@@ -277,12 +592,22 @@ int lorawan_process_timeout_ms(uint32_t timeout_ms) {
   do {
     lorawan_process();
 
-    if (AppRxData.Port) {
+    if (lorawan_peek_downlink() != NULL) {
       return 0;
     } else if (joined != lorawan_is_joined()) {
       return 0;
     }
-  } while (!best_effort_wfe_or_timeout(timeout_time));
+
+    lorawan_nvm_process(true, LmHandlerIsBusy(), Radio.GetStatus() == RF_IDLE);
+
+    // Checked with interrupts masked, so an event raised in between still
+    // wakes the board up
+    CRITICAL_SECTION_BEGIN();
+    if (IsMacProcessPending == 0) {
+      BoardLowPowerHandlerUntil(timeout_time);
+    }
+    CRITICAL_SECTION_END();
+  } while (!time_reached(timeout_time));
 
   return 1; // timed out
 }
@@ -301,36 +626,141 @@ int lorawan_send_unconfirmed(const void *data, uint8_t data_len, uint8_t app_por
   return 0;
 }
 
+int lorawan_queue_uplink(const struct lorawan_uplink *uplink) {
+  if (uplink->data_len > LORAWAN_APP_DATA_BUFFER_MAX_SIZE) {
+    return -1;
+  }
+
+  for (int i = 0; i < LORAWAN_UPLINK_QUEUE_SIZE; i++) {
+    if (UplinkQueue.Entries[i].Used) {
+      continue;
+    }
+
+    UplinkQueue.Entries[i].Confirmed = uplink->confirmed;
+    UplinkQueue.Entries[i].Port = uplink->app_port;
+    UplinkQueue.Entries[i].Priority = uplink->priority;
+    UplinkQueue.Entries[i].Size = uplink->data_len;
+    UplinkQueue.Entries[i].Seq = UplinkQueue.Seq++;
+    UplinkQueue.Entries[i].Expiry =
+        (uplink->expiry_ms != 0) ? make_timeout_time_ms(uplink->expiry_ms) : at_the_end_of_time;
+    UplinkQueue.Entries[i].Callback = uplink->callback;
+    UplinkQueue.Entries[i].Context = uplink->context;
+    memcpy(UplinkQueue.Entries[i].Buffer, uplink->data, uplink->data_len);
+    UplinkQueue.Entries[i].Used = true;
+
+    // Sent by the next lorawan_process call
+    IsMacProcessPending = 1;
+
+    return 0;
+  }
+
+  return -1;
+}
+
+int lorawan_uplinks_queued() {
+  int count = 0;
+
+  for (int i = 0; i < LORAWAN_UPLINK_QUEUE_SIZE; i++) {
+    if (UplinkQueue.Entries[i].Used) {
+      count++;
+    }
+  }
+
+  return count;
+}
+
 int lorawan_receive(void *data, uint8_t data_len, uint8_t *app_port) {
-  *app_port = AppRxData.Port;
-  if (*app_port == 0) {
+  const struct lorawan_downlink *downlink = lorawan_peek_downlink();
+
+  if (downlink == NULL) {
+    *app_port = 0;
     return -1;
   }
 
-  int receive_length = AppRxData.BufferSize;
+  int receive_length = downlink->data_len;
 
   if (data_len < receive_length) {
     receive_length = data_len;
   }
 
-  memcpy(data, AppRxData.Buffer, receive_length);
-  AppRxData.Port = 0;
+  *app_port = downlink->app_port;
+  memcpy(data, downlink->data, receive_length);
+
+  lorawan_release_downlink();
 
   return receive_length;
 }
 
+const struct lorawan_downlink *lorawan_peek_downlink() {
+  uint32_t tail = Downlinks.Tail;
+
+  if (tail == Downlinks.Head) {
+    return NULL;
+  }
+
+  // Read the entry only after seeing the Head that published it
+  __dmb();
+
+  return &Downlinks.Entries[tail % LORAWAN_DOWNLINK_QUEUE_SIZE].Info;
+}
+
+void lorawan_release_downlink() {
+  uint32_t tail = Downlinks.Tail;
+
+  if (tail == Downlinks.Head) {
+    return;
+  }
+
+  // Done with the entry before the producer may reuse it
+  __dmb();
+
+  Downlinks.Tail = tail + 1;
+}
+
+uint32_t lorawan_get_downlink_drops() { return Downlinks.Drops; }
+
 void lorawan_debug(bool debug) { Debug = debug; }
 
-int lorawan_erase_nvm() {
-  if (!NvmDataMgmtFactoryReset()) {
+uint32_t lorawan_get_max_rx_error() { return RxTiming.MaxRxError; }
+
+int lorawan_request_time() {
+  if (LmhpClockSyncAppTimeReq() != LORAMAC_HANDLER_SUCCESS) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int lorawan_get_time(uint32_t *gps_seconds, uint16_t *milliseconds) {
+  SysTime_t now = SysTimeGet();
+  uint32_t offsetSeconds;
+  uint32_t offsetSubSeconds;
+
+  // SysTime keeps its offset from the time since boot in the RTC backup
+  // registers, it stays zero until DeviceTimeAns or AppTimeAns set the
+  // network time
+  RtcBkupRead(&offsetSeconds, &offsetSubSeconds);
+
+  if ((offsetSeconds == 0) && (offsetSubSeconds == 0)) {
+    *gps_seconds = now.Seconds;
+    *milliseconds = now.SubSeconds;
     return -1;
   }
 
-  EepromMcuFlush();
+  *gps_seconds = now.Seconds - UNIX_GPS_EPOCH_OFFSET;
+  *milliseconds = now.SubSeconds;
 
   return 0;
 }
 
+int lorawan_erase_nvm() {
+  if (!NvmDataMgmtFactoryReset()) {
+    return -1;
+  }
+
+  return lorawan_nvm_flush(false);
+}
+
 static void OnMacProcessNotify(void) { IsMacProcessPending = 1; }
 
 static void OnNvmDataChange(LmHandlerNvmContextStates_t state, uint16_t size) {
@@ -338,7 +768,12 @@ static void OnNvmDataChange(LmHandlerNvmContextStates_t state, uint16_t size) {
     DisplayNvmDataChange(state, size);
   }
 
-  EepromMcuFlush();
+  if (state != LORAMAC_HANDLER_NVM_STORE) {
+    return;
+  }
+
+  lorawan_nvm_stored(NvmWrites.FCnt, NvmWrites.Changed);
+  NvmWrites.Changed = false;
 }
 
 static void OnNetworkParametersChange(CommissioningParams_t *params) {
@@ -524,6 +959,10 @@ static void OnMacMcpsRequest(LoRaMacStatus_t status, McpsReq_t *mcpsReq, TimerTi
   if (Debug) {
     DisplayMacMcpsRequestUpdate(status, mcpsReq, nextTxIn);
   }
+
+  if (status == LORAMAC_STATUS_DUTYCYCLE_RESTRICTED) {
+    UplinkQueue.NextTx = make_timeout_time_ms(nextTxIn);
+  }
 }
 
 static void OnMacMlmeRequest(LoRaMacStatus_t status, MlmeReq_t *mlmeReq, TimerTime_t nextTxIn) {
@@ -548,6 +987,87 @@ static void OnTxData(LmHandlerTxParams_t *params) {
   if (Debug) {
     DisplayTxUpdate(params);
   }
+
+  if (!params->IsMcpsConfirm || (UplinkQueue.InFlight < 0)) {
+    return;
+  }
+
+  int index = UplinkQueue.InFlight;
+  enum lorawan_uplink_status status = LORAWAN_UPLINK_SENT;
+
+  UplinkQueue.InFlight = -1;
+
+  if (params->Status != LORAMAC_EVENT_INFO_STATUS_OK) {
+    status = LORAWAN_UPLINK_FAILED;
+  } else if (UplinkQueue.Entries[index].Confirmed && !params->AckReceived) {
+    status = LORAWAN_UPLINK_NOT_ACKED;
+  }
+
+  UplinkComplete(index, status);
+}
+
+/*!
+ * \brief Feeds the timing of a received downlink into the RX error estimator
+ */
+static void UpdateRxError(LmHandlerRxParams_t *params) {
+  uint64_t txDone;
+  uint64_t rxEdge;
+  MibRequestConfirm_t mibReq;
+
+  if ((RadioBackend->get_rx_timing == NULL) || !RadioBackend->get_rx_timing(&txDone, &rxEdge) ||
+      (params->Datarate < 0) || (params->Datarate >= 16)) {
+    return;
+  }
+
+  if (params->RxSlot == RX_SLOT_WIN_1) {
+    mibReq.Type = MIB_RECEIVE_DELAY_1;
+  } else if (params->RxSlot == RX_SLOT_WIN_2) {
+    mibReq.Type = MIB_RECEIVE_DELAY_2;
+  } else {
+    return;
+  }
+  LoRaMacMibGetRequestConfirm(&mibReq);
+
+  uint32_t delay = (params->RxSlot == RX_SLOT_WIN_1) ? mibReq.Param.ReceiveDelay1
+                                                     : mibReq.Param.ReceiveDelay2;
+  int64_t offset = (int64_t)(rxEdge - txDone) - (int64_t)delay * 1000;
+
+  // Anything further off was not the preamble of this frame
+  if ((offset < -(int64_t)RxTiming.MaxRxError * 1000) || (offset > 1000000)) {
+    return;
+  }
+
+  uint8_t dr = params->Datarate;
+
+  if (RxTiming.BaselineSamples[dr]++ == 0) {
+    RxTiming.Baseline[dr] = offset;
+    return;
+  }
+
+  int32_t error = offset - RxTiming.Baseline[dr];
+
+  // Gains of 1/8 and 1/4, as used for SRTT and RTTVAR
+  RxTiming.Baseline[dr] += error / 8;
+  RxTiming.Deviation += ((int32_t)abs(error) - (int32_t)RxTiming.Deviation) / 4;
+  RxTiming.Samples++;
+
+  if (RxTiming.Samples < LORAWAN_RX_ERROR_MIN_SAMPLES) {
+    return;
+  }
+
+  // Cover four deviations, as the retransmission timeout does
+  uint32_t maxRxError = (4 * RxTiming.Deviation + 999) / 1000;
+
+  if (maxRxError < LORAWAN_RX_ERROR_FLOOR_MS) {
+    maxRxError = LORAWAN_RX_ERROR_FLOOR_MS;
+  } else if (maxRxError > LORAWAN_RX_ERROR_DEFAULT_MS) {
+    maxRxError = LORAWAN_RX_ERROR_DEFAULT_MS;
+  }
+
+  if (maxRxError != RxTiming.MaxRxError) {
+    RxTiming.MaxRxError = maxRxError;
+    LmHandlerSetSystemMaxRxError(maxRxError);
+  }
 }
 
 static void OnRxData(LmHandlerAppData_t *appData, LmHandlerRxParams_t *params) {
@@ -555,9 +1075,35 @@ static void OnRxData(LmHandlerAppData_t *appData, LmHandlerRxParams_t *params) {
     DisplayRxUpdate(appData, params);
   }
 
-  memcpy(AppRxData.Buffer, appData->Buffer, appData->BufferSize);
-  AppRxData.BufferSize = appData->BufferSize;
-  AppRxData.Port = appData->Port;
+  UpdateRxError(params);
+
+  // Port 0 carries MAC commands only
+  if (appData->Port == 0) {
+    return;
+  }
+
+  uint32_t head = Downlinks.Head;
+
+  if ((head - Downlinks.Tail) == LORAWAN_DOWNLINK_QUEUE_SIZE) {
+    Downlinks.Drops++;
+    return;
+  }
+
+  struct lorawan_downlink *info = &Downlinks.Entries[head % LORAWAN_DOWNLINK_QUEUE_SIZE].Info;
+
+  memcpy(Downlinks.Entries[head % LORAWAN_DOWNLINK_QUEUE_SIZE].Buffer, appData->Buffer,
+         appData->BufferSize);
+  info->data = Downlinks.Entries[head % LORAWAN_DOWNLINK_QUEUE_SIZE].Buffer;
+  info->data_len = appData->BufferSize;
+  info->app_port = appData->Port;
+  info->rssi = params->Rssi;
+  info->snr = params->Snr;
+  info->timestamp_us = time_us_64();
+
+  // Publish the entry only after it has been written
+  __dmb();
+
+  Downlinks.Head = head + 1;
 }
 
 static void OnClassChange(DeviceClass_t deviceClass) {
@@ -593,6 +1139,8 @@ static void OnBeaconStatusChange(LoRaMacHandlerBeaconParams_t *params) {
   }
 }
 
+// SysTime has already been corrected when these are called, lorawan_get_time
+// reads it directly
 #if (LMH_SYS_TIME_UPDATE_NEW_API == 1)
 static void OnSysTimeUpdate(bool isSynchronized, int32_t timeCorrection) {}
 #else
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * The RAM cache build of eeprom-board.c, linked next to the EEPROM_XIP_READS
+ * build as the reference its reads are checked against. Its functions take
+ * a RamEeprom prefix and it keeps its journal in ram_flash, whose erase and
+ * program functions are provided by the test.
+ */
+
+#undef EEPROM_XIP_READS
+#define EEPROM_XIP_READS 0
+
+#define stub_flash ram_flash
+#define flash_range_erase ram_flash_range_erase
+#define flash_range_program ram_flash_range_program
+
+#define EepromMcuInit RamEepromMcuInit
+#define EepromMcuReadBuffer RamEepromMcuReadBuffer
+#define EepromMcuWriteBuffer RamEepromMcuWriteBuffer
+#define EepromMcuFlush RamEepromMcuFlush
+#define EepromMcuTryFlush RamEepromMcuTryFlush
+#define EepromSetWriteFilter RamEepromSetWriteFilter
+#define EepromGetStats RamEepromGetStats
+#define EepromResetStats RamEepromResetStats
+
+#include "../src/boards/rp2040/eeprom-board.c"
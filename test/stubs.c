@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * State behind the host stand-ins for the pico-sdk and LoRaMac-node.
+ */
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hardware/clocks.h"
+#include "hardware/flash.h"
+#include "hardware/irq.h"
+#include "hardware/regs/m0plus.h"
+#include "hardware/spi.h"
+#include "hardware/structs/scb.h"
+#include "hardware/timer.h"
+#include "hardware/uart.h"
+#include "pico/time.h"
+
+#include "delay.h"
+#include "utilities.h"
+
+#include "test.h"
+
+uint64_t stub_time_us = 0;
+
+uint stub_exception = 0;
+
+uint8_t stub_flash[PICO_FLASH_SIZE_BYTES];
+
+uint32_t stub_ppb[4];
+
+timer_hw_t stub_timer_hw;
+
+clocks_hw_t stub_clocks_hw;
+
+armv6m_scb_hw_t stub_scb_hw;
+
+uart_hw_t stub_uart_hw[2];
+
+irq_handler_t stub_irq_handlers[32];
+
+void (*stub_event_hook)(void) = NULL;
+
+unsigned test_failures = 0;
+
+static struct spi_inst {
+  int id;
+} spi_instances[2] = {{0}, {1}};
+
+spi_inst_t *const stub_spi0 = &spi_instances[0];
+spi_inst_t *const stub_spi1 = &spi_instances[1];
+
+static jmp_buf *panic_target = NULL;
+
+void stub_expect_panic(jmp_buf *target) { panic_target = target; }
+
+void panic(const char *fmt, ...) {
+  va_list args;
+
+  if (panic_target != NULL) {
+    jmp_buf *target = panic_target;
+
+    panic_target = NULL;
+    longjmp(*target, 1);
+  }
+
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+  fputc('\n', stderr);
+  abort();
+}
+
+void stub_wait_for_event(void) {
+  if (stub_event_hook != NULL) {
+    stub_event_hook();
+  }
+}
+
+void DelayMs(uint32_t ms) { stub_time_us += (uint64_t)ms * 1000; }
+
+// Weak, test_board links the ones of board.c
+__attribute__((weak)) void BoardCriticalSectionBegin(uint32_t *mask) { *mask = 0; }
+
+__attribute__((weak)) void BoardCriticalSectionEnd(uint32_t *mask) {}
+
+uint32_t Crc32Init(void) { return 0xFFFFFFFF; }
+
+uint32_t Crc32Update(uint32_t crcInit, uint8_t *buffer, uint16_t length) {
+  uint32_t crc = crcInit;
+
+  for (uint16_t i = 0; i < length; i++) {
+    crc ^= buffer[i];
+    for (uint j = 0; j < 8; j++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+  }
+
+  return crc;
+}
+
+uint32_t Crc32Finalize(uint32_t crc) { return ~crc; }
+
+uint32_t Crc32(uint8_t *buffer, uint16_t length) {
+  return Crc32Finalize(Crc32Update(Crc32Init(), buffer, length));
+}
+
+uint32_t test_random(uint32_t *state) {
+  // xorshift32, reproducible across hosts
+  uint32_t x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+
+  return x;
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host stand-in for the parts of LoRaMac-node's LoRaMac.h used by the
+ * library headers.
+ */
+
+#ifndef _TEST_STUB_LORAMAC_H_
+#define _TEST_STUB_LORAMAC_H_
+
+#include "pico.h"
+
+typedef enum eLoRaMacRegion {
+  LORAMAC_REGION_AS923,
+  LORAMAC_REGION_AU915,
+  LORAMAC_REGION_CN470,
+  LORAMAC_REGION_CN779,
+  LORAMAC_REGION_EU433,
+  LORAMAC_REGION_EU868,
+  LORAMAC_REGION_KR920,
+  LORAMAC_REGION_IN865,
+  LORAMAC_REGION_US915,
+  LORAMAC_REGION_RU864,
+} LoRaMacRegion_t;
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _TEST_STUB_BOARD_H_
+#define _TEST_STUB_BOARD_H_
+
+#include "utilities.h"
+
+void BoardInitMcu(void);
+
+void BoardInitPeriph(void);
+
+void BoardLowPowerHandler(void);
+
+uint8_t BoardGetBatteryLevel(void);
+
+uint32_t BoardGetRandomSeed(void);
+
+void BoardGetUniqueId(uint8_t *id);
+
+void BoardResetMcu(void);
+
+#endif
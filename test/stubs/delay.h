@@ -0,0 +1,9 @@
+#ifndef _TEST_STUB_DELAY_H_
+#define _TEST_STUB_DELAY_H_
+
+#include "pico.h"
+
+// Moves stub_time_us forward
+void DelayMs(uint32_t ms);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef _TEST_STUB_EEPROM_BOARD_H_
+#define _TEST_STUB_EEPROM_BOARD_H_
+
+#include "utilities.h"
+
+void EepromMcuInit(void);
+
+uint8_t EepromMcuWriteBuffer(uint16_t addr, uint8_t *buffer, uint16_t size);
+
+uint8_t EepromMcuReadBuffer(uint16_t addr, uint8_t *buffer, uint16_t size);
+
+#endif
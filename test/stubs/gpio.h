@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host stand-in for LoRaMac-node's gpio.h, the functions are provided by the
+ * test.
+ */
+
+#ifndef _TEST_STUB_GPIO_H_
+#define _TEST_STUB_GPIO_H_
+
+#include "pico.h"
+
+typedef uint32_t PinNames;
+
+#define NC ((PinNames)0xffffffff)
+
+typedef enum { PIN_INPUT = 0, PIN_OUTPUT, PIN_ALTERNATE_FCT, PIN_ANALOGIC } PinModes;
+
+typedef enum { PIN_NO_PULL = 0, PIN_PULL_UP, PIN_PULL_DOWN } PinTypes;
+
+typedef enum { PIN_PUSH_PULL = 0, PIN_OPEN_DRAIN } PinConfigs;
+
+typedef enum { NO_IRQ = 0, IRQ_RISING_EDGE, IRQ_FALLING_EDGE, IRQ_RISING_FALLING_EDGE } IrqModes;
+
+typedef enum {
+  IRQ_VERY_LOW_PRIORITY = 0,
+  IRQ_LOW_PRIORITY,
+  IRQ_MEDIUM_PRIORITY,
+  IRQ_HIGH_PRIORITY,
+  IRQ_VERY_HIGH_PRIORITY
+} IrqPriorities;
+
+typedef void(GpioIrqHandler)(void *context);
+
+typedef struct {
+  PinNames pin;
+  uint16_t pinIndex;
+  void *port;
+  uint16_t portIndex;
+  PinTypes pull;
+  void *Context;
+  GpioIrqHandler *IrqHandler;
+} Gpio_t;
+
+void GpioInit(Gpio_t *obj, PinNames pin, PinModes mode, PinConfigs config, PinTypes type, uint32_t value);
+
+void GpioSetInterrupt(Gpio_t *obj, IrqModes irqMode, IrqPriorities irqPriority, GpioIrqHandler *irqHandler);
+
+void GpioWrite(Gpio_t *obj, uint32_t value);
+
+uint32_t GpioRead(Gpio_t *obj);
+
+#endif
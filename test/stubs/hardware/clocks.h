@@ -0,0 +1,40 @@
+#ifndef _TEST_STUB_HARDWARE_CLOCKS_H_
+#define _TEST_STUB_HARDWARE_CLOCKS_H_
+
+#include "pico.h"
+
+enum clock_index { clk_ref = 4, clk_sys = 5, clk_peri = 6 };
+
+#define CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLK_REF 0x0
+#define CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLKSRC_CLK_SYS_AUX 0x1
+#define CLOCKS_CLK_SYS_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS 0x0
+
+#define CLOCKS_SLEEP_EN0_CLK_ADC_ADC_BITS 0x00000002
+#define CLOCKS_SLEEP_EN0_CLK_SYS_ADC_BITS 0x00000004
+#define CLOCKS_SLEEP_EN0_CLK_SYS_I2C0_BITS 0x00000040
+#define CLOCKS_SLEEP_EN0_CLK_SYS_I2C1_BITS 0x00000080
+#define CLOCKS_SLEEP_EN0_CLK_SYS_JTAG_BITS 0x00000200
+#define CLOCKS_SLEEP_EN0_CLK_SYS_PWM_BITS 0x00020000
+#define CLOCKS_SLEEP_EN0_CLK_SYS_ROM_BITS 0x00080000
+#define CLOCKS_SLEEP_EN0_CLK_RTC_RTC_BITS 0x00200000
+#define CLOCKS_SLEEP_EN0_CLK_SYS_RTC_BITS 0x00400000
+
+#define CLOCKS_SLEEP_EN1_CLK_SYS_TBMAN_BITS 0x00000010
+#define CLOCKS_SLEEP_EN1_CLK_SYS_XIP_BITS 0x00004000
+
+typedef struct {
+  io_rw_32 sleep_en0;
+  io_rw_32 sleep_en1;
+} clocks_hw_t;
+
+extern clocks_hw_t stub_clocks_hw;
+
+#define clocks_hw (&stub_clocks_hw)
+
+static inline uint32_t clock_get_hz(enum clock_index clk_index) { return 125000000; }
+
+// Provided by the test that switches clocks
+bool clock_configure(enum clock_index clk_index, uint32_t src, uint32_t auxsrc, uint32_t src_freq,
+                     uint32_t freq);
+
+#endif
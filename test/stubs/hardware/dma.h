@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host stand-in for hardware/dma.h, the channel functions are provided by
+ * the test.
+ */
+
+#ifndef _TEST_STUB_HARDWARE_DMA_H_
+#define _TEST_STUB_HARDWARE_DMA_H_
+
+#include "pico.h"
+
+#define NUM_DMA_CHANNELS 12
+
+enum dma_channel_transfer_size { DMA_SIZE_8 = 0, DMA_SIZE_16 = 1, DMA_SIZE_32 = 2 };
+
+typedef struct {
+  uint32_t ctrl;
+  bool read_increment;
+  bool write_increment;
+} dma_channel_config;
+
+int dma_claim_unused_channel(bool required);
+
+static inline dma_channel_config dma_channel_get_default_config(uint channel) {
+  return (dma_channel_config){.read_increment = true, .write_increment = false};
+}
+
+static inline void channel_config_set_transfer_data_size(dma_channel_config *c,
+                                                         enum dma_channel_transfer_size size) {}
+
+static inline void channel_config_set_dreq(dma_channel_config *c, uint dreq) {}
+
+static inline void channel_config_set_read_increment(dma_channel_config *c, bool incr) {
+  c->read_increment = incr;
+}
+
+static inline void channel_config_set_write_increment(dma_channel_config *c, bool incr) {
+  c->write_increment = incr;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger);
+
+void dma_start_channel_mask(uint32_t chan_mask);
+
+bool dma_channel_is_busy(uint channel);
+
+static inline void dma_channel_set_irq0_enabled(uint channel, bool enabled) {}
+
+bool dma_channel_get_irq0_status(uint channel);
+
+void dma_channel_acknowledge_irq0(uint channel);
+
+#endif
@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host stand-in for hardware/flash.h, XIP maps stub_flash. The erase and
+ * program functions are provided by the test.
+ */
+
+#ifndef _TEST_STUB_HARDWARE_FLASH_H_
+#define _TEST_STUB_HARDWARE_FLASH_H_
+
+#include "pico.h"
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+
+extern uint8_t stub_flash[PICO_FLASH_SIZE_BYTES];
+
+#define XIP_BASE ((uintptr_t)stub_flash)
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+#endif
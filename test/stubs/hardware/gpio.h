@@ -0,0 +1,12 @@
+#ifndef _TEST_STUB_HARDWARE_GPIO_H_
+#define _TEST_STUB_HARDWARE_GPIO_H_
+
+#include "pico.h"
+
+#define NUM_BANK0_GPIOS 30
+
+enum gpio_function { GPIO_FUNC_SPI = 1, GPIO_FUNC_PIO0 = 6, GPIO_FUNC_PIO1 = 7 };
+
+static inline void gpio_set_function(uint gpio, enum gpio_function fn) {}
+
+#endif
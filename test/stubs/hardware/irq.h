@@ -0,0 +1,29 @@
+#ifndef _TEST_STUB_HARDWARE_IRQ_H_
+#define _TEST_STUB_HARDWARE_IRQ_H_
+
+#include "pico.h"
+
+#define TIMER_IRQ_0 0
+#define TIMER_IRQ_1 1
+#define TIMER_IRQ_2 2
+#define TIMER_IRQ_3 3
+#define USBCTRL_IRQ 5
+#define DMA_IRQ_0 11
+#define IO_IRQ_BANK0 13
+
+#define PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY 0x80
+
+typedef void (*irq_handler_t)(void);
+
+// Handlers registered per IRQ number, a single one each
+extern irq_handler_t stub_irq_handlers[32];
+
+static inline void irq_set_exclusive_handler(uint num, irq_handler_t handler) { stub_irq_handlers[num] = handler; }
+
+static inline void irq_add_shared_handler(uint num, irq_handler_t handler, uint8_t order_priority) {
+  stub_irq_handlers[num] = handler;
+}
+
+static inline void irq_set_enabled(uint num, bool enabled) {}
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host stand-in for hardware/pio.h. The FIFO, restart and program counter
+ * functions are provided by the test that selects the PIO engine.
+ */
+
+#ifndef _TEST_STUB_HARDWARE_PIO_H_
+#define _TEST_STUB_HARDWARE_PIO_H_
+
+#include "pico.h"
+
+typedef struct pio_hw pio_hw_t;
+
+typedef pio_hw_t *PIO;
+
+typedef struct pio_program {
+  const uint16_t *instructions;
+  uint8_t length;
+  int8_t origin;
+} pio_program_t;
+
+enum pio_src_dest { pio_pins = 0 };
+
+static inline int pio_claim_unused_sm(PIO pio, bool required) { return 0; }
+
+static inline uint pio_add_program(PIO pio, const pio_program_t *program) { return 0; }
+
+static inline void pio_sm_set_clkdiv(PIO pio, uint sm, float div) {}
+
+static inline void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {}
+
+static inline void pio_sm_clear_fifos(PIO pio, uint sm) {}
+
+void pio_sm_restart(PIO pio, uint sm);
+
+static inline void pio_sm_exec(PIO pio, uint sm, uint instr) {}
+
+static inline uint pio_encode_set(enum pio_src_dest dest, uint value) { return 0; }
+
+static inline uint pio_encode_sideset(uint sideset_bit_count, uint value) { return 0; }
+
+static inline uint pio_encode_jmp(uint addr) { return 0; }
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data);
+
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm);
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+
+uint32_t pio_sm_get(PIO pio, uint sm);
+
+uint8_t pio_sm_get_pc(PIO pio, uint sm);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef _TEST_STUB_HARDWARE_REGS_M0PLUS_H_
+#define _TEST_STUB_HARDWARE_REGS_M0PLUS_H_
+
+#include "pico.h"
+
+extern uint32_t stub_ppb[4];
+
+#define PPB_BASE ((uintptr_t)stub_ppb)
+#define M0PLUS_NVIC_ISER_OFFSET 0x0
+#define M0PLUS_NVIC_ICER_OFFSET 0x4
+#define M0PLUS_NVIC_ISPR_OFFSET 0x8
+#define M0PLUS_NVIC_ICPR_OFFSET 0xc
+#define M0PLUS_SCR_SLEEPDEEP_BITS 0x00000004
+
+#endif
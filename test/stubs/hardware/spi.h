@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host stand-in for hardware/spi.h, the transfer functions are provided by
+ * the test.
+ */
+
+#ifndef _TEST_STUB_HARDWARE_SPI_H_
+#define _TEST_STUB_HARDWARE_SPI_H_
+
+#include "pico.h"
+
+typedef struct {
+  io_rw_32 dr;
+} spi_hw_t;
+
+typedef struct spi_inst spi_inst_t;
+
+extern spi_inst_t *const stub_spi0;
+extern spi_inst_t *const stub_spi1;
+
+#define spi0 stub_spi0
+#define spi1 stub_spi1
+
+typedef enum { SPI_CPHA_0 = 0, SPI_CPHA_1 = 1 } spi_cpha_t;
+typedef enum { SPI_CPOL_0 = 0, SPI_CPOL_1 = 1 } spi_cpol_t;
+typedef enum { SPI_LSB_FIRST = 0, SPI_MSB_FIRST = 1 } spi_order_t;
+
+uint spi_init(spi_inst_t *spi, uint baudrate);
+
+uint spi_set_baudrate(spi_inst_t *spi, uint baudrate);
+
+static inline void spi_set_format(spi_inst_t *spi, uint data_bits, spi_cpol_t cpol, spi_cpha_t cpha,
+                                  spi_order_t order) {}
+
+spi_hw_t *spi_get_hw(spi_inst_t *spi);
+
+static inline uint spi_get_dreq(spi_inst_t *spi, bool is_tx) { return is_tx ? 16 : 17; }
+
+int spi_write_read_blocking(spi_inst_t *spi, const uint8_t *src, uint8_t *dst, size_t len);
+
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len);
+
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef _TEST_STUB_HARDWARE_STRUCTS_SCB_H_
+#define _TEST_STUB_HARDWARE_STRUCTS_SCB_H_
+
+#include "pico.h"
+
+typedef struct {
+  io_rw_32 cpuid;
+  io_rw_32 icsr;
+  io_rw_32 vtor;
+  io_rw_32 aircr;
+  io_rw_32 scr;
+} armv6m_scb_hw_t;
+
+extern armv6m_scb_hw_t stub_scb_hw;
+
+#define scb_hw (&stub_scb_hw)
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef _TEST_STUB_HARDWARE_SYNC_H_
+#define _TEST_STUB_HARDWARE_SYNC_H_
+
+#include "pico.h"
+
+static inline uint32_t save_and_disable_interrupts(void) { return 0; }
+
+static inline void restore_interrupts(uint32_t status) {}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef _TEST_STUB_HARDWARE_TIMER_H_
+#define _TEST_STUB_HARDWARE_TIMER_H_
+
+#include "pico.h"
+
+typedef struct {
+  io_rw_32 alarm[4];
+  io_rw_32 armed;
+  io_rw_32 intr;
+  io_rw_32 inte;
+  io_rw_32 intf;
+} timer_hw_t;
+
+extern timer_hw_t stub_timer_hw;
+
+#define timer_hw (&stub_timer_hw)
+
+static inline void hw_set_bits(io_rw_32 *addr, uint32_t mask) { *addr |= mask; }
+
+static inline void hw_clear_bits(io_rw_32 *addr, uint32_t mask) { *addr &= ~mask; }
+
+static inline int hardware_alarm_claim_unused(bool required) { return 0; }
+
+#endif
@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host stand-in for hardware/uart.h, a UART is only its control register.
+ */
+
+#ifndef _TEST_STUB_HARDWARE_UART_H_
+#define _TEST_STUB_HARDWARE_UART_H_
+
+#include "pico.h"
+
+#define UART_UARTCR_UARTEN_BITS 0x00000001
+#define UART_UARTCR_TXE_BITS 0x00000100
+#define UART_UARTCR_RXE_BITS 0x00000200
+
+typedef struct {
+  io_rw_32 cr;
+} uart_hw_t;
+
+typedef struct uart_inst uart_inst_t;
+
+extern uart_hw_t stub_uart_hw[2];
+
+#define uart0 ((uart_inst_t *)&stub_uart_hw[0])
+#define uart1 ((uart_inst_t *)&stub_uart_hw[1])
+
+static inline uart_hw_t *uart_get_hw(uart_inst_t *uart) { return (uart_hw_t *)uart; }
+
+static inline bool uart_is_enabled(uart_inst_t *uart) {
+  return (uart_get_hw(uart)->cr & UART_UARTCR_UARTEN_BITS) != 0;
+}
+
+static inline void uart_tx_wait_blocking(uart_inst_t *uart) {}
+
+#endif
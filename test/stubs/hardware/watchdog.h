@@ -0,0 +1,8 @@
+#ifndef _TEST_STUB_HARDWARE_WATCHDOG_H_
+#define _TEST_STUB_HARDWARE_WATCHDOG_H_
+
+#include "pico.h"
+
+static inline void watchdog_reboot(uint32_t pc, uint32_t sp, uint32_t delay_ms) {}
+
+#endif
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host stand-in for the pico-sdk base header.
+ */
+
+#ifndef _TEST_STUB_PICO_H_
+#define _TEST_STUB_PICO_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned int uint;
+
+typedef volatile uint32_t io_rw_32;
+
+#define __not_in_flash_func(func) func
+
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+
+#define PICO_FLASH_SIZE_BYTES (64 * 1024)
+
+// Returns to the point set by stub_expect_panic, aborts otherwise
+void panic(const char *fmt, ...);
+
+// Called by __wfe and __wfi, lets a test deliver interrupts while code waits
+void stub_wait_for_event(void);
+
+static inline void tight_loop_contents(void) {}
+
+static inline void __sev(void) {}
+
+static inline void __wfe(void) { stub_wait_for_event(); }
+
+static inline void __wfi(void) { stub_wait_for_event(); }
+
+static inline void __dmb(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+
+// Exception number reported by __get_current_exception, 0 in thread mode
+extern uint stub_exception;
+
+static inline uint __get_current_exception(void) { return stub_exception; }
+
+static inline uint get_core_num(void) { return 0; }
+
+#endif
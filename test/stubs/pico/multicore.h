@@ -0,0 +1,12 @@
+#ifndef _TEST_STUB_PICO_MULTICORE_H_
+#define _TEST_STUB_PICO_MULTICORE_H_
+
+#include "pico.h"
+
+static inline bool multicore_lockout_victim_is_initialized(uint core) { return false; }
+
+static inline void multicore_lockout_start_blocking(void) {}
+
+static inline void multicore_lockout_end_blocking(void) {}
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef _TEST_STUB_PICO_STDLIB_H_
+#define _TEST_STUB_PICO_STDLIB_H_
+
+#include "pico.h"
+#include "pico/time.h"
+#include "hardware/gpio.h"
+
+#endif
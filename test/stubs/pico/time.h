@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host stand-in for pico/time.h, the time only moves when a test sets
+ * stub_time_us.
+ */
+
+#ifndef _TEST_STUB_PICO_TIME_H_
+#define _TEST_STUB_PICO_TIME_H_
+
+#include "pico.h"
+
+typedef uint64_t absolute_time_t;
+
+typedef int32_t alarm_id_t;
+
+typedef int64_t (*alarm_callback_t)(alarm_id_t id, void *user_data);
+
+extern uint64_t stub_time_us;
+
+#define at_the_end_of_time ((absolute_time_t)0x7fffffffffffffffull)
+
+static inline uint64_t time_us_64(void) { return stub_time_us; }
+
+static inline uint32_t time_us_32(void) { return (uint32_t)stub_time_us; }
+
+static inline absolute_time_t get_absolute_time(void) { return stub_time_us; }
+
+static inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+
+static inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
+
+static inline absolute_time_t delayed_by_us(absolute_time_t t, uint64_t us) { return t + us; }
+
+static inline absolute_time_t make_timeout_time_us(uint64_t us) { return stub_time_us + us; }
+
+static inline absolute_time_t make_timeout_time_ms(uint32_t ms) { return stub_time_us + (uint64_t)ms * 1000; }
+
+static inline int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to) {
+  return (int64_t)(to - from);
+}
+
+static inline bool time_reached(absolute_time_t t) { return stub_time_us >= t; }
+
+static inline bool is_at_the_end_of_time(absolute_time_t t) { return t == at_the_end_of_time; }
+
+static inline bool best_effort_wfe_or_timeout(absolute_time_t t) {
+  stub_wait_for_event();
+  return time_reached(t);
+}
+
+// Provided by the test that sets alarms
+alarm_id_t add_alarm_at(absolute_time_t time, alarm_callback_t callback, void *user_data,
+                        bool fire_if_past);
+
+bool cancel_alarm(alarm_id_t alarm_id);
+
+#endif
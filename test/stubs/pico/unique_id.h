@@ -0,0 +1,16 @@
+#ifndef _TEST_STUB_PICO_UNIQUE_ID_H_
+#define _TEST_STUB_PICO_UNIQUE_ID_H_
+
+#include <string.h>
+
+#include "pico.h"
+
+typedef struct {
+  uint8_t id[8];
+} pico_unique_board_id_t;
+
+static inline void pico_get_unique_board_id(pico_unique_board_id_t *id_out) {
+  memset(id_out->id, 0, sizeof(id_out->id));
+}
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _TEST_STUB_RADIO_H_
+#define _TEST_STUB_RADIO_H_
+
+#include "pico.h"
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef _TEST_STUB_RTC_BOARD_H_
+#define _TEST_STUB_RTC_BOARD_H_
+
+#include "timer.h"
+
+void RtcInit(void);
+
+uint32_t RtcGetMinimumTimeout(void);
+
+uint32_t RtcMs2Tick(TimerTime_t milliseconds);
+
+TimerTime_t RtcTick2Ms(uint32_t tick);
+
+void RtcSetAlarm(uint32_t timeout);
+
+void RtcStopAlarm(void);
+
+uint32_t RtcSetTimerContext(void);
+
+uint32_t RtcGetTimerContext(void);
+
+uint32_t RtcGetCalendarTime(uint16_t *milliseconds);
+
+uint32_t RtcGetTimerValue(void);
+
+uint32_t RtcGetTimerElapsedTime(void);
+
+void RtcBkupWrite(uint32_t data0, uint32_t data1);
+
+void RtcBkupRead(uint32_t *data0, uint32_t *data1);
+
+void RtcProcess(void);
+
+TimerTime_t RtcTempCompensation(TimerTime_t period, float temperature);
+
+#endif
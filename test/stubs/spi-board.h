@@ -0,0 +1,6 @@
+#ifndef _TEST_STUB_SPI_BOARD_H_
+#define _TEST_STUB_SPI_BOARD_H_
+
+#include "spi.h"
+
+#endif
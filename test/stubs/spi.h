@@ -0,0 +1,22 @@
+#ifndef _TEST_STUB_SPI_H_
+#define _TEST_STUB_SPI_H_
+
+#include "gpio.h"
+
+typedef enum { SPI_1, SPI_2 } SpiId_t;
+
+typedef struct Spi_s {
+  SpiId_t SpiId;
+  Gpio_t Mosi;
+  Gpio_t Miso;
+  Gpio_t Sclk;
+  Gpio_t Nss;
+} Spi_t;
+
+void SpiInit(Spi_t *obj, SpiId_t spiId, PinNames mosi, PinNames miso, PinNames sclk, PinNames nss);
+
+void SpiFrequency(Spi_t *obj, uint32_t hz);
+
+uint16_t SpiInOut(Spi_t *obj, uint16_t outData);
+
+#endif
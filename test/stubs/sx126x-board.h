@@ -0,0 +1,58 @@
+#ifndef _TEST_STUB_SX126X_BOARD_H_
+#define _TEST_STUB_SX126X_BOARD_H_
+
+#include "sx126x.h"
+
+void SX126xIoInit(void);
+
+void SX126xIoIrqInit(DioIrqHandler dioIrq);
+
+void SX126xIoDeInit(void);
+
+void SX126xIoTcxoInit(void);
+
+void SX126xIoRfSwitchInit(void);
+
+void SX126xIoDbgInit(void);
+
+void SX126xReset(void);
+
+void SX126xWaitOnBusy(void);
+
+void SX126xWakeup(void);
+
+void SX126xWriteCommand(RadioCommands_t opcode, uint8_t *buffer, uint16_t size);
+
+uint8_t SX126xReadCommand(RadioCommands_t opcode, uint8_t *buffer, uint16_t size);
+
+void SX126xWriteRegisters(uint16_t address, uint8_t *buffer, uint16_t size);
+
+void SX126xWriteRegister(uint16_t address, uint8_t value);
+
+void SX126xReadRegisters(uint16_t address, uint8_t *buffer, uint16_t size);
+
+uint8_t SX126xReadRegister(uint16_t address);
+
+void SX126xWriteBuffer(uint8_t offset, uint8_t *buffer, uint8_t size);
+
+void SX126xReadBuffer(uint8_t offset, uint8_t *buffer, uint8_t size);
+
+void SX126xSetRfTxPower(int8_t power);
+
+uint8_t SX126xGetDeviceId(void);
+
+void SX126xAntSwOn(void);
+
+void SX126xAntSwOff(void);
+
+bool SX126xCheckRfFrequency(uint32_t frequency);
+
+uint32_t SX126xGetBoardTcxoWakeupTime(void);
+
+uint32_t SX126xGetDio1PinState(void);
+
+RadioOperatingModes_t SX126xGetOperatingMode(void);
+
+void SX126xSetOperatingMode(RadioOperatingModes_t mode);
+
+#endif
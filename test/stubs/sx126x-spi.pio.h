@@ -0,0 +1,11 @@
+#ifndef _TEST_STUB_SX126X_SPI_PIO_H_
+#define _TEST_STUB_SX126X_SPI_PIO_H_
+
+#include "hardware/pio.h"
+
+static const pio_program_t sx126x_spi_program = {0};
+
+static inline void sx126x_spi_program_init(PIO pio, uint sm, uint offset, float freq, uint mosi,
+                                           uint miso, uint sck, uint nss, uint busy) {}
+
+#endif
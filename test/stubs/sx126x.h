@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host stand-in for the parts of LoRaMac-node's sx126x.h used by the board
+ * layer, with the opcodes and register addresses of the datasheet.
+ */
+
+#ifndef _TEST_STUB_SX126X_H_
+#define _TEST_STUB_SX126X_H_
+
+#include "gpio.h"
+#include "spi.h"
+
+#define SX1261 1
+#define SX1262 2
+
+#define REG_LR_SYNCWORD 0x0740
+#define REG_IQ_POLARITY 0x0736
+#define REG_RX_GAIN 0x08AC
+#define REG_TX_CLAMP_CFG 0x08D8
+#define REG_OCP 0x08E7
+
+typedef enum {
+  RADIO_GET_STATUS = 0xC0,
+  RADIO_WRITE_REGISTER = 0x0D,
+  RADIO_READ_REGISTER = 0x1D,
+  RADIO_WRITE_BUFFER = 0x0E,
+  RADIO_READ_BUFFER = 0x1E,
+  RADIO_SET_SLEEP = 0x84,
+  RADIO_SET_STANDBY = 0x80,
+  RADIO_SET_FS = 0xC1,
+  RADIO_SET_TX = 0x83,
+  RADIO_SET_RX = 0x82,
+  RADIO_SET_PACKETTYPE = 0x8A,
+  RADIO_SET_RFFREQUENCY = 0x86,
+  RADIO_SET_TXPARAMS = 0x8E,
+  RADIO_SET_PACONFIG = 0x95,
+  RADIO_SET_BUFFERBASEADDRESS = 0x8F,
+  RADIO_SET_MODULATIONPARAMS = 0x8B,
+  RADIO_SET_PACKETPARAMS = 0x8C,
+  RADIO_GET_IRQSTATUS = 0x12,
+  RADIO_CLR_IRQSTATUS = 0x02,
+  RADIO_CFG_DIOIRQ = 0x08,
+  RADIO_CALIBRATE = 0x89,
+  RADIO_CALIBRATEIMAGE = 0x98,
+  RADIO_SET_TCXOMODE = 0x97,
+} RadioCommands_t;
+
+typedef enum {
+  MODE_SLEEP = 0x00,
+  MODE_STDBY_RC,
+  MODE_STDBY_XOSC,
+  MODE_FS,
+  MODE_TX,
+  MODE_RX,
+  MODE_RX_DC,
+  MODE_CAD
+} RadioOperatingModes_t;
+
+typedef union {
+  uint8_t Value;
+} CalibrationParams_t;
+
+typedef enum { TCXO_CTRL_1_7V = 0x02 } RadioTcxoCtrlVoltages_t;
+
+typedef enum { RADIO_RAMP_40_US = 0x02 } RadioRampTimes_t;
+
+typedef void(DioIrqHandler)(void *context);
+
+typedef struct SX126x_s {
+  Gpio_t Reset;
+  Gpio_t BUSY;
+  Gpio_t DIO1;
+  Spi_t Spi;
+} SX126x_t;
+
+extern SX126x_t SX126x;
+
+void SX126xCheckDeviceReady(void);
+
+void SX126xCalibrate(CalibrationParams_t calibParam);
+
+void SX126xSetDio2AsRfSwitchCtrl(uint8_t enable);
+
+void SX126xSetDio3AsTcxoCtrl(RadioTcxoCtrlVoltages_t tcxoVoltage, uint32_t timeout);
+
+void SX126xSetTxParams(int8_t power, RadioRampTimes_t rampTime);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef _TEST_STUB_TIMER_H_
+#define _TEST_STUB_TIMER_H_
+
+#include "pico.h"
+
+typedef uint32_t TimerTime_t;
+
+typedef struct TimerEvent_s {
+  uint32_t Timestamp;
+  uint32_t ReloadValue;
+  bool IsStarted;
+  bool IsNext2Expire;
+  void (*Callback)(void *context);
+  void *Context;
+  struct TimerEvent_s *Next;
+} TimerEvent_t;
+
+void TimerInit(TimerEvent_t *obj, void (*callback)(void *context));
+
+void TimerSetContext(TimerEvent_t *obj, void *context);
+
+void TimerIrqHandler(void);
+
+void TimerStart(TimerEvent_t *obj);
+
+bool TimerIsStarted(TimerEvent_t *obj);
+
+void TimerStop(TimerEvent_t *obj);
+
+void TimerReset(TimerEvent_t *obj);
+
+void TimerSetValue(TimerEvent_t *obj, uint32_t value);
+
+TimerTime_t TimerGetCurrentTime(void);
+
+TimerTime_t TimerGetElapsedTime(TimerTime_t past);
+
+TimerTime_t TimerTempCompensation(TimerTime_t period, float temperature);
+
+void TimerProcess(void);
+
+#endif
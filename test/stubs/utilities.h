@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Host stand-in for the parts of LoRaMac-node's utilities.h used by the
+ * board layer.
+ */
+
+#ifndef _TEST_STUB_UTILITIES_H_
+#define _TEST_STUB_UTILITIES_H_
+
+#include "pico.h"
+
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+typedef enum LmnStatus_e {
+  LMN_STATUS_ERROR = 0,
+  LMN_STATUS_OK = !LMN_STATUS_ERROR,
+} LmnStatus_t;
+
+void BoardCriticalSectionBegin(uint32_t *mask);
+
+void BoardCriticalSectionEnd(uint32_t *mask);
+
+#define CRITICAL_SECTION_BEGIN()                                                                   \
+  uint32_t mask;                                                                                   \
+  BoardCriticalSectionBegin(&mask)
+
+#define CRITICAL_SECTION_END() BoardCriticalSectionEnd(&mask)
+
+uint32_t Crc32(uint8_t *buffer, uint16_t length);
+
+uint32_t Crc32Init(void);
+
+uint32_t Crc32Update(uint32_t crcInit, uint8_t *buffer, uint16_t length);
+
+uint32_t Crc32Finalize(uint32_t crc);
+
+#endif
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Minimal assertions for the host tests of the RP2040 board layer.
+ */
+
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+
+extern unsigned test_failures;
+
+/*!
+ * \brief Called on every WFE/WFI, lets a test deliver pending interrupts
+ */
+extern void (*stub_event_hook)(void);
+
+/*!
+ * \brief Makes the next panic longjmp to target instead of aborting
+ */
+void stub_expect_panic(jmp_buf *target);
+
+/*!
+ * \brief Returns the next value of a xorshift32 sequence
+ */
+uint32_t test_random(uint32_t *state);
+
+#define CHECK(cond)                                                                                \
+  do {                                                                                             \
+    if (!(cond)) {                                                                                 \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);                    \
+      test_failures++;                                                                             \
+    }                                                                                              \
+  } while (0)
+
+#define CHECK_EQ(actual, expected)                                                                 \
+  do {                                                                                             \
+    long long _a = (long long)(actual);                                                            \
+    long long _e = (long long)(expected);                                                          \
+    if (_a != _e) {                                                                                \
+      fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, _a, _e);  \
+      test_failures++;                                                                             \
+    }                                                                                              \
+  } while (0)
+
+#define TEST_RESULT() ((test_failures == 0) ? 0 : 1)
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Checks the clock state BoardLowPowerHandler sleeps in.
+ *
+ * The WFI records the clocks as the core enters sleep, then moves the time
+ * to the next RTC alarm and raises its IRQ. The sleep_en gating only counts
+ * when SLEEPDEEP is set at that point.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "board.h"
+#include "hardware/clocks.h"
+#include "hardware/regs/m0plus.h"
+#include "hardware/structs/scb.h"
+#include "hardware/uart.h"
+#include "pico/board-rp2040.h"
+#include "pico/time.h"
+
+#include "test.h"
+
+#define ALARM_IRQ 0
+
+static uint64_t AlarmTarget;
+
+static bool DmaBusy;
+
+/*!
+ * Source of clk_sys, CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLK_REF when lowered
+ */
+static uint32_t SysSource = CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLKSRC_CLK_SYS_AUX;
+
+/*!
+ * State seen by the last WFI
+ */
+static struct {
+  uint32_t Count;
+  bool SleepDeep;
+  bool Lowered;
+  uint32_t En0;
+  uint32_t En1;
+} Wfi;
+
+uint64_t RtcGetAlarmTarget(void) { return AlarmTarget; }
+
+uint RtcGetAlarmIrq(void) { return ALARM_IRQ; }
+
+uint8_t EepromMcuFlush(void) { return LMN_STATUS_OK; }
+
+bool dma_channel_is_busy(uint channel) { return DmaBusy && (channel == 3); }
+
+alarm_id_t add_alarm_at(absolute_time_t time, alarm_callback_t callback, void *user_data,
+                        bool fire_if_past) {
+  return 1;
+}
+
+bool cancel_alarm(alarm_id_t alarm_id) { return true; }
+
+bool clock_configure(enum clock_index clk_index, uint32_t src, uint32_t auxsrc, uint32_t src_freq,
+                     uint32_t freq) {
+  CHECK_EQ(clk_index, clk_sys);
+  SysSource = src;
+
+  return true;
+}
+
+static void OnWfi(void) {
+  Wfi.Count++;
+  Wfi.SleepDeep = (scb_hw->scr & M0PLUS_SCR_SLEEPDEEP_BITS) != 0;
+  Wfi.Lowered = SysSource == CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLK_REF;
+  Wfi.En0 = clocks_hw->sleep_en0;
+  Wfi.En1 = clocks_hw->sleep_en1;
+
+  stub_time_us = AlarmTarget;
+  stub_ppb[M0PLUS_NVIC_ISPR_OFFSET / 4] = 1u << ALARM_IRQ;
+}
+
+/*!
+ * \brief Sleeps until the RTC alarm due in us
+ */
+static void Sleep(uint64_t us) {
+  stub_ppb[M0PLUS_NVIC_ISPR_OFFSET / 4] = 0;
+  AlarmTarget = stub_time_us + us;
+  memset(&Wfi, 0, sizeof(Wfi));
+
+  BoardLowPowerHandler();
+
+  // Back at full clock and out of deep sleep
+  CHECK_EQ(Wfi.Count, 1);
+  CHECK(SysSource == CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLKSRC_CLK_SYS_AUX);
+  CHECK((scb_hw->scr & M0PLUS_SCR_SLEEPDEEP_BITS) == 0);
+  CHECK_EQ(clocks_hw->sleep_en0, 0xffffffff);
+  CHECK_EQ(clocks_hw->sleep_en1, 0xffffffff);
+}
+
+static void TestGating(void) {
+  BoardPowerStats_t stats;
+
+  BoardResetPowerStats();
+
+  Sleep(10 * BOARD_LOW_POWER_XOSC_MIN_US);
+  CHECK(Wfi.SleepDeep);
+  CHECK(Wfi.Lowered);
+  CHECK((Wfi.En0 & CLOCKS_SLEEP_EN0_CLK_SYS_ADC_BITS) == 0);
+  CHECK((Wfi.En0 & CLOCKS_SLEEP_EN0_CLK_SYS_PWM_BITS) == 0);
+  CHECK((Wfi.En1 & CLOCKS_SLEEP_EN1_CLK_SYS_XIP_BITS) == 0);
+
+  // A short sleep keeps clk_sys, the gating still applies
+  Sleep(BOARD_LOW_POWER_XOSC_MIN_US / 2);
+  CHECK(Wfi.SleepDeep);
+  CHECK(!Wfi.Lowered);
+  CHECK((Wfi.En0 & CLOCKS_SLEEP_EN0_CLK_SYS_ADC_BITS) == 0);
+
+  BoardGetPowerStats(&stats);
+  CHECK_EQ(stats.LowClockSleeps, 1);
+  CHECK_EQ(stats.Sleeps, 1);
+  CHECK_EQ(stats.WakeRtc, 2);
+  CHECK_EQ(stats.LowClockSleepUs, 10 * BOARD_LOW_POWER_XOSC_MIN_US);
+}
+
+static void TestPeripheralsKeepClock(void) {
+  // A transmit only UART is drained, the clock can drop
+  uart_get_hw(uart0)->cr = UART_UARTCR_UARTEN_BITS | UART_UARTCR_TXE_BITS;
+  Sleep(10 * BOARD_LOW_POWER_XOSC_MIN_US);
+  CHECK(Wfi.Lowered);
+
+  // A receiving UART would sample at the wrong baud rate
+  uart_get_hw(uart1)->cr = UART_UARTCR_UARTEN_BITS | UART_UARTCR_TXE_BITS | UART_UARTCR_RXE_BITS;
+  Sleep(10 * BOARD_LOW_POWER_XOSC_MIN_US);
+  CHECK(Wfi.SleepDeep);
+  CHECK(!Wfi.Lowered);
+
+  // RXE without UARTEN receives nothing
+  uart_get_hw(uart1)->cr = UART_UARTCR_RXE_BITS;
+  Sleep(10 * BOARD_LOW_POWER_XOSC_MIN_US);
+  CHECK(Wfi.Lowered);
+
+  uart_get_hw(uart0)->cr = 0;
+  uart_get_hw(uart1)->cr = 0;
+
+  DmaBusy = true;
+  Sleep(10 * BOARD_LOW_POWER_XOSC_MIN_US);
+  CHECK(!Wfi.Lowered);
+  DmaBusy = false;
+}
+
+int main(void) {
+  clocks_hw->sleep_en0 = 0xffffffff;
+  clocks_hw->sleep_en1 = 0xffffffff;
+  stub_event_hook = OnWfi;
+
+  TestGating();
+  TestPeripheralsKeepClock();
+
+  return TEST_RESULT();
+}
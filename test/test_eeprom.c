@@ -0,0 +1,738 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Exercises the NVM journal of eeprom-board.c on a simulated flash.
+ *
+ * Erasing sets bytes to 0xff, programming can only clear bits, and both take
+ * the typical W25Q16JV time of the Pico's flash, so EepromStats_t.BusyUs
+ * reports the time the CPU stalls in flash operations. Power can be cut in
+ * the middle of any operation, which then leaves its range half done.
+ *
+ * Also built with EEPROM_XIP_READS, then the RAM cache build of eeprom_ram.c
+ * runs on a second flash and every read is compared against it.
+ */
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "eeprom-board.h"
+#include "hardware/flash.h"
+#include "pico/board-rp2040.h"
+#include "pico/time.h"
+#include "utilities.h"
+
+#include "test.h"
+
+#define FLASH_ERASE_US 45000
+#define FLASH_PROGRAM_US 400
+
+#define NVM_SIZE FLASH_SECTOR_SIZE
+#define NVM_OFFSET (PICO_FLASH_SIZE_BYTES - EEPROM_SECTORS * FLASH_SECTOR_SIZE)
+#define LEGACY_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+
+/*!
+ * Image the journal must hold, updated along with every write
+ */
+static uint8_t Model[NVM_SIZE];
+
+/*!
+ * Image of the last flush, which a reboot restores
+ */
+static uint8_t Committed[NVM_SIZE];
+
+/*!
+ * Power cut injection, the cut lands in the operation after Ops more
+ */
+static struct {
+  bool Armed;
+  bool Erase; //! The cut operation was an erase
+  uint32_t Ops;
+  uint32_t Seed;
+  jmp_buf Reboot;
+} PowerCut = {.Seed = 0x5eed};
+
+/*!
+ * RTC alarm seen by the erase guard, 0 for none. Set to AlarmAfterErase
+ * when a sector erase ends, as a timer firing then would.
+ */
+static uint64_t AlarmTarget = 0;
+static uint64_t AlarmAfterErase = 0;
+
+uint32_t RtcDeferAlarms(bool defer) { return 0; }
+
+uint64_t RtcGetAlarmTarget(void) { return AlarmTarget; }
+
+static void FlashErase(uint8_t *flash, uint32_t flash_offs, size_t count) {
+  CHECK_EQ(flash_offs % FLASH_SECTOR_SIZE, 0);
+  CHECK_EQ(count % FLASH_SECTOR_SIZE, 0);
+  CHECK(flash_offs >= NVM_OFFSET);
+
+  if (PowerCut.Armed && (PowerCut.Ops-- == 0)) {
+    // Some bytes are erased already, others are left anywhere in between
+    for (size_t i = 0; i < count; i++) {
+      uint32_t r = test_random(&PowerCut.Seed);
+
+      if ((r & 3) == 0) {
+        flash[flash_offs + i] = 0xff;
+      } else if ((r & 3) == 1) {
+        flash[flash_offs + i] |= r >> 8;
+      }
+    }
+    PowerCut.Armed = false;
+    PowerCut.Erase = true;
+    longjmp(PowerCut.Reboot, 1);
+  }
+
+  memset(flash + flash_offs, 0xff, count);
+  stub_time_us += (count / FLASH_SECTOR_SIZE) * FLASH_ERASE_US;
+
+  if (AlarmAfterErase != 0) {
+    AlarmTarget = AlarmAfterErase;
+    AlarmAfterErase = 0;
+  }
+}
+
+static void FlashProgram(uint8_t *flash, uint32_t flash_offs, const uint8_t *data, size_t count) {
+  CHECK_EQ(flash_offs % FLASH_PAGE_SIZE, 0);
+  CHECK_EQ(count % FLASH_PAGE_SIZE, 0);
+  CHECK(flash_offs >= NVM_OFFSET);
+
+  size_t cut = count;
+
+  if (PowerCut.Armed && (PowerCut.Ops-- == 0)) {
+    cut = test_random(&PowerCut.Seed) % count;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    uint8_t *byte = &flash[flash_offs + i];
+
+    if (i == cut) {
+      // The byte being programmed has some of its bits cleared
+      *byte &= data[i] | test_random(&PowerCut.Seed);
+      PowerCut.Armed = false;
+      PowerCut.Erase = false;
+      longjmp(PowerCut.Reboot, 1);
+    }
+
+    // 0xff leaves a byte as it is, any other value must not need a 1 where
+    // a 0 already is
+    CHECK((data[i] == 0xff) || ((*byte & data[i]) == data[i]));
+    *byte &= data[i];
+  }
+  stub_time_us += (count / FLASH_PAGE_SIZE) * FLASH_PROGRAM_US;
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count) { FlashErase(stub_flash, flash_offs, count); }
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+  FlashProgram(stub_flash, flash_offs, data, count);
+}
+
+static void Write(uint16_t addr, const uint8_t *data, uint16_t size) {
+  EepromStats_t before;
+  EepromStats_t after;
+
+  EepromGetStats(&before);
+  CHECK_EQ(EepromMcuWriteBuffer(addr, (uint8_t *)data, size), LMN_STATUS_OK);
+  EepromGetStats(&after);
+
+  if (after.Flushes != before.Flushes) {
+    // The overlay was full, the earlier changes were flushed first
+    memcpy(Committed, Model, sizeof(Committed));
+  }
+  memcpy(Model + addr, data, size);
+}
+
+static void CheckImage(void) {
+  uint8_t image[NVM_SIZE];
+
+  CHECK_EQ(EepromMcuReadBuffer(0, image, sizeof(image)), LMN_STATUS_OK);
+  CHECK(memcmp(image, Model, sizeof(image)) == 0);
+}
+
+/*!
+ * \brief Starts over from erased flash
+ */
+static void Format(void) {
+  memset(stub_flash, 0xff, sizeof(stub_flash));
+  memset(Model, 0xff, sizeof(Model));
+  memset(Committed, 0xff, sizeof(Committed));
+  EepromMcuInit();
+  EepromResetStats();
+}
+
+static void TestDirtyRuns(void) {
+  EepromStats_t stats;
+  uint8_t data[400];
+
+  Format();
+
+  for (uint i = 0; i < sizeof(data); i++) {
+    data[i] = i;
+  }
+
+  // Chunks 3 to 5 and chunk 9 changed, one record per run
+  Write(3 * 16 + 4, data, 40);
+  Write(9 * 16, data, 1);
+  EepromMcuFlush();
+
+  EepromGetStats(&stats);
+  CHECK_EQ(stats.Compactions, 1);
+
+  // The first flush compacts, the journal starts after it
+  EepromResetStats();
+  Write(3 * 16 + 4, data + 1, 40);
+  Write(9 * 16, data + 1, 1);
+  EepromMcuFlush();
+
+  EepromGetStats(&stats);
+  CHECK_EQ(stats.Flushes, 1);
+  CHECK_EQ(stats.Compactions, 0);
+  CHECK_EQ(stats.SectorErases, 0);
+  CHECK_EQ(stats.Records, 2);
+  CHECK_EQ(stats.RecordBytes, 3 * 16 + 16);
+
+  // Writing what is stored already changes nothing
+  EepromResetStats();
+  Write(3 * 16 + 4, data + 1, 40);
+  EepromMcuFlush();
+
+  EepromGetStats(&stats);
+  CHECK_EQ(stats.Flushes, 0);
+  CHECK_EQ(stats.Records, 0);
+
+  // A run longer than a record is split
+  EepromResetStats();
+  Write(1024, data, 20 * 16);
+  EepromMcuFlush();
+
+  EepromGetStats(&stats);
+  CHECK_EQ(stats.Records, 2);
+  CHECK_EQ(stats.RecordBytes, 20 * 16);
+
+  CheckImage();
+
+  // The records are replayed on boot
+  EepromMcuInit();
+  CheckImage();
+}
+
+static void TestLegacyMigration(void) {
+  EepromStats_t stats;
+
+  Format();
+
+  // An image stored as is in the last sector by earlier releases
+  for (uint i = 0; i < NVM_SIZE; i++) {
+    stub_flash[LEGACY_OFFSET + i] = Model[i] = (i * 13) ^ (i >> 4);
+  }
+
+  EepromMcuInit();
+  CheckImage();
+
+  EepromGetStats(&stats);
+  CHECK_EQ(stats.Compactions, 1);
+
+  // The legacy sector belongs to the second bank, the first one holds the
+  // image now
+  memset(stub_flash + LEGACY_OFFSET, 0xff, FLASH_SECTOR_SIZE);
+  EepromMcuInit();
+  CheckImage();
+
+  // With a timer due the migration waits for the next flush, the image is
+  // read from the legacy sector meanwhile
+  Format();
+  for (uint i = 0; i < NVM_SIZE; i++) {
+    stub_flash[LEGACY_OFFSET + i] = Model[i] = (i * 7) ^ (i >> 3);
+  }
+
+  AlarmTarget = stub_time_us + EEPROM_ERASE_GUARD_US / 2;
+  EepromMcuInit();
+  AlarmTarget = 0;
+  CheckImage();
+
+  EepromGetStats(&stats);
+  CHECK_EQ(stats.Compactions, 0);
+  CHECK_EQ(stats.Deferrals, 1);
+
+  CHECK_EQ(EepromMcuTryFlush(), LMN_STATUS_OK);
+  memset(stub_flash + LEGACY_OFFSET, 0xff, FLASH_SECTOR_SIZE);
+  EepromMcuInit();
+  CheckImage();
+}
+
+/*!
+ * Groups written on every uplink, in the layout of LoRaMac-node's
+ * LoRaMacNvmData_t, each closed by a Crc32
+ */
+#define UPLINK_CRYPTO_ADDR 0
+#define UPLINK_CRYPTO_SIZE 52
+#define UPLINK_MAC_ADDR (UPLINK_CRYPTO_ADDR + UPLINK_CRYPTO_SIZE)
+#define UPLINK_MAC_SIZE 112
+
+static void StoreGroup(uint16_t addr, uint16_t size, uint16_t field, uint32_t value) {
+  uint8_t group[128];
+
+  memcpy(group, Model + addr, size);
+  memcpy(group + field, &value, sizeof(value));
+
+  uint32_t crc = Crc32(group, size - sizeof(crc));
+
+  memcpy(group + size - sizeof(crc), &crc, sizeof(crc));
+
+  Write(addr, group, size);
+}
+
+/*!
+ * \brief Runs uplinks the way LmHandler stores them, flushing every
+ *        flushEvery uplinks
+ *
+ * The frame counter lives in the crypto group, MAC group 1 holds the ADR
+ * ack counter and the last TX time.
+ */
+static void RunUplinks(uint32_t uplinks, uint32_t flushEvery, EepromStats_t *stats) {
+  Format();
+
+  for (uint32_t fcnt = 1; fcnt <= uplinks; fcnt++) {
+    StoreGroup(UPLINK_CRYPTO_ADDR, UPLINK_CRYPTO_SIZE, 8, fcnt);
+    StoreGroup(UPLINK_MAC_ADDR, UPLINK_MAC_SIZE, 20, fcnt % 64);
+    StoreGroup(UPLINK_MAC_ADDR, UPLINK_MAC_SIZE, 60, (uint32_t)(stub_time_us / 1000));
+
+    // An uplink every minute, flash time included
+    stub_time_us += 60 * 1000 * 1000;
+
+    if ((fcnt % flushEvery) == 0) {
+      EepromMcuFlush();
+    }
+  }
+  EepromMcuFlush();
+
+  EepromGetStats(stats);
+
+  CheckImage();
+  EepromMcuInit();
+  CheckImage();
+}
+
+static void BenchUplinks(void) {
+  const uint32_t uplinks = 10000;
+  EepromStats_t every;
+  EepromStats_t reserved;
+
+  RunUplinks(uplinks, 1, &every);
+  // A reservation of 64 frame counters is flushed every 32 uplinks
+  RunUplinks(uplinks, 32, &reserved);
+
+  printf("per %u uplinks  %8s %8s %11s %7s %12s %9s\n", uplinks, "flushes", "records", "compactions", "erases",
+         "busy ms", "max ms");
+
+  // The single sector layout erased and rewrote the sector on every flush
+  printf("%-16s %8u %8s %11s %7u %12u %9u\n", "single sector", uplinks, "-", "-", uplinks,
+         uplinks * (FLASH_ERASE_US + NVM_SIZE / FLASH_PAGE_SIZE * FLASH_PROGRAM_US) / 1000,
+         (FLASH_ERASE_US + NVM_SIZE / FLASH_PAGE_SIZE * FLASH_PROGRAM_US) / 1000);
+  printf("%-16s %8u %8u %11u %7u %12llu %9u\n", "journal", every.Flushes, every.Records, every.Compactions,
+         every.SectorErases, (unsigned long long)every.BusyUs / 1000, every.MaxFlushUs / 1000);
+  printf("%-16s %8u %8u %11u %7u %12llu %9u\n", "journal fcnt/64", reserved.Flushes, reserved.Records,
+         reserved.Compactions, reserved.SectorErases, (unsigned long long)reserved.BusyUs / 1000,
+         reserved.MaxFlushUs / 1000);
+
+  // An uplink dirties 5 chunks in 4 runs, 112 bytes of records. The 3840
+  // byte log of a bank takes 34 of them before a compaction erases the 2
+  // sectors of the other bank, a flush that compacts appends no record.
+  CHECK_EQ(every.Flushes, uplinks);
+  CHECK_EQ(every.SectorErases, every.Compactions * EEPROM_SECTORS / 2);
+  CHECK_EQ(every.Records, 4 * (uplinks - every.Compactions));
+  CHECK(every.SectorErases < (uplinks / 10));
+  CHECK(every.BusyUs < ((uint64_t)uplinks * (FLASH_ERASE_US + NVM_SIZE / FLASH_PAGE_SIZE * FLASH_PROGRAM_US) / 8));
+  CHECK(reserved.Compactions <= (uplinks / 32 / 34 + 1));
+}
+
+/*!
+ * \brief Writes a random range of Model to the EEPROM
+ */
+static void WriteRandom(uint32_t *seed) {
+  uint8_t data[300];
+  uint16_t size = 1 + test_random(seed) % (((test_random(seed) % 8) == 0) ? sizeof(data) : 48);
+  uint16_t addr = test_random(seed) % (NVM_SIZE - size);
+
+  for (uint i = 0; i < size; i++) {
+    data[i] = test_random(seed);
+  }
+
+  Write(addr, data, size);
+}
+
+/*!
+ * \brief Cuts power at random points of flushes
+ *
+ * Every reboot must restore a committed image: the one of the last flush
+ * that returned, or the one of the interrupted flush if its commit point
+ * had been reached, never a mix of the two.
+ */
+static void TestPowerCuts(void) {
+  uint8_t image[NVM_SIZE];
+  uint32_t seed = 0xfeed;
+  uint32_t cuts[2][2] = {{0}}; // [in compaction][new image restored]
+
+  Format();
+
+  for (uint round = 0; round < 10000; round++) {
+    EepromStats_t before;
+    EepromStats_t after;
+    uint writes = 1 + test_random(&seed) % 4;
+
+    for (uint i = 0; i < writes; i++) {
+      WriteRandom(&seed);
+    }
+
+    // A compaction takes 2 erases and 17 programs, an append a few programs
+    PowerCut.Ops = test_random(&seed) % 24;
+    PowerCut.Armed = (test_random(&seed) % 4) != 0;
+
+    EepromGetStats(&before);
+
+    if (setjmp(PowerCut.Reboot) == 0) {
+      EepromMcuFlush();
+      PowerCut.Armed = false;
+      memcpy(Committed, Model, sizeof(Committed));
+
+      if ((test_random(&seed) % 8) == 0) {
+        // Power lost between flushes, with changes pending
+        WriteRandom(&seed);
+        EepromMcuInit();
+        memcpy(Model, Committed, sizeof(Model));
+      }
+      CheckImage();
+      continue;
+    }
+
+    EepromGetStats(&after);
+
+    bool compaction = PowerCut.Erase || (after.SectorErases != before.SectorErases);
+
+    EepromMcuInit();
+    EepromMcuReadBuffer(0, image, sizeof(image));
+
+    if (memcmp(image, Model, sizeof(image)) == 0) {
+      memcpy(Committed, Model, sizeof(Committed));
+      cuts[compaction][1]++;
+    } else {
+      CHECK(memcmp(image, Committed, sizeof(image)) == 0);
+      memcpy(Model, Committed, sizeof(Model));
+      cuts[compaction][0]++;
+    }
+
+    // A torn log is compacted by the next flush, which may be cut as well
+  }
+
+  EepromMcuInit();
+  CheckImage();
+
+  printf("power cuts      %8s %8s\n", "old", "new");
+  printf("%-15s %8u %8u\n", "append", cuts[0][0], cuts[0][1]);
+  printf("%-15s %8u %8u\n", "compaction", cuts[1][0], cuts[1][1]);
+
+  CHECK(cuts[0][0] > 100);
+  CHECK(cuts[1][0] > 100);
+  CHECK(cuts[1][1] > 0);
+}
+
+static void TestPowerCutMigration(void) {
+  uint8_t legacy[NVM_SIZE];
+
+  for (uint ops = 0; ops < 24; ops++) {
+    Format();
+
+    for (uint i = 0; i < NVM_SIZE; i++) {
+      legacy[i] = Model[i] = (i * 7) ^ ops;
+    }
+    memcpy(stub_flash + LEGACY_OFFSET, legacy, NVM_SIZE);
+
+    PowerCut.Ops = ops;
+    PowerCut.Armed = true;
+
+    if (setjmp(PowerCut.Reboot) == 0) {
+      EepromMcuInit();
+    }
+    PowerCut.Armed = false;
+
+    // The legacy sector is only erased by the compaction after the
+    // migration, so the image survives every cut of the migration
+    EepromMcuInit();
+    CheckImage();
+  }
+}
+
+static void TestFallbacks(void) {
+  static uint8_t saved[EEPROM_SECTORS * FLASH_SECTOR_SIZE];
+  uint32_t bank1 = NVM_OFFSET + EEPROM_SECTORS / 2 * FLASH_SECTOR_SIZE;
+  EepromStats_t stats;
+  uint8_t data[64];
+
+  Format();
+
+  // The first compaction fills bank 0, the second bank 1
+  for (uint i = 0; i < 1000; i++) {
+    memset(data, i, sizeof(data));
+    Write((i * sizeof(data)) % NVM_SIZE, data, sizeof(data));
+    EepromMcuFlush();
+    memcpy(Committed, Model, sizeof(Committed));
+
+    EepromGetStats(&stats);
+    if (stats.Compactions == 2) {
+      break;
+    }
+  }
+  CHECK_EQ(stats.Compactions, 2);
+  memcpy(saved, stub_flash + NVM_OFFSET, sizeof(saved));
+
+  // Bank 1 is the only valid bank, loading it is no fallback
+  memset(stub_flash + NVM_OFFSET, 0xff, FLASH_PAGE_SIZE);
+  EepromResetStats();
+  EepromMcuInit();
+  CheckImage();
+  EepromGetStats(&stats);
+  CHECK_EQ(stats.Fallbacks, 0);
+
+  // The snapshot of the newer bank 1 is torn, bank 0 is loaded instead
+  memcpy(stub_flash + NVM_OFFSET, saved, sizeof(saved));
+  stub_flash[bank1 + FLASH_PAGE_SIZE] ^= 0xff;
+  EepromResetStats();
+  EepromMcuInit();
+  EepromGetStats(&stats);
+  CHECK_EQ(stats.Fallbacks, 1);
+
+  memcpy(stub_flash + NVM_OFFSET, saved, sizeof(saved));
+  EepromMcuInit();
+  CheckImage();
+}
+
+static void TestEraseGuard(void) {
+  EepromStats_t stats;
+  uint8_t data[64];
+
+  Format();
+
+  for (uint i = 0; i < sizeof(data); i++) {
+    data[i] = i;
+  }
+
+  // The first flush compacts, not with a timer due during the erase
+  Write(100, data, sizeof(data));
+  AlarmTarget = stub_time_us + EEPROM_ERASE_GUARD_US - 1;
+
+  CHECK_EQ(EepromMcuTryFlush(), LMN_STATUS_ERROR);
+
+  EepromGetStats(&stats);
+  CHECK_EQ(stats.Deferrals, 1);
+  CHECK_EQ(stats.SectorErases, 0);
+  CheckImage();
+
+  // An alarm due after the worst case of both erases lets them run
+  AlarmTarget = stub_time_us + EEPROM_SECTORS / 2 * EEPROM_ERASE_GUARD_US;
+  CHECK_EQ(EepromMcuTryFlush(), LMN_STATUS_OK);
+  memcpy(Committed, Model, sizeof(Committed));
+
+  // Appending programs only, due timers do not hold it back
+  Write(200, data, sizeof(data));
+  AlarmTarget = stub_time_us + 1;
+  CHECK_EQ(EepromMcuTryFlush(), LMN_STATUS_OK);
+  memcpy(Committed, Model, sizeof(Committed));
+
+  // Fill the log until the next flush compacts
+  AlarmTarget = 0;
+  EepromResetStats();
+  for (uint round = 0; stats.Compactions == 0; round++) {
+    data[0] = round;
+    Write(16 * (round % 200), data, 64);
+    CHECK_EQ(EepromMcuTryFlush(), LMN_STATUS_OK);
+    memcpy(Committed, Model, sizeof(Committed));
+    EepromGetStats(&stats);
+  }
+
+  for (uint round = 0; stats.Compactions == 1; round++) {
+    data[0] = round ^ 0xff;
+    Write(16 * (round % 200), data, 64);
+
+    // A timer that fires after the first sector is erased arms an alarm
+    // due within the second erase
+    AlarmAfterErase = stub_time_us + FLASH_ERASE_US + 1000;
+
+    if (EepromMcuTryFlush() == LMN_STATUS_OK) {
+      memcpy(Committed, Model, sizeof(Committed));
+      EepromGetStats(&stats);
+      continue;
+    }
+
+    EepromGetStats(&stats);
+    // One sector erased past the first compaction
+    CHECK_EQ(stats.Deferrals, 1);
+    CHECK_EQ(stats.SectorErases, EEPROM_SECTORS / 2 + 1);
+    CheckImage();
+    break;
+  }
+  AlarmAfterErase = 0;
+
+  // The half erased bank is not used, a reboot restores the last flush
+  EepromMcuInit();
+  memcpy(Model, Committed, sizeof(Model));
+  CheckImage();
+
+  // Retried once the timer has fired
+  Write(300, data, sizeof(data));
+  AlarmTarget = 0;
+  CHECK_EQ(EepromMcuTryFlush(), LMN_STATUS_OK);
+
+  EepromGetStats(&stats);
+  CHECK_EQ(stats.Compactions, 2);
+
+  EepromMcuInit();
+  CheckImage();
+}
+
+#if EEPROM_XIP_READS
+uint8_t ram_flash[PICO_FLASH_SIZE_BYTES];
+
+void ram_flash_range_erase(uint32_t flash_offs, size_t count) { FlashErase(ram_flash, flash_offs, count); }
+
+void ram_flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+  FlashProgram(ram_flash, flash_offs, data, count);
+}
+
+void RamEepromMcuInit(void);
+uint8_t RamEepromMcuReadBuffer(uint16_t addr, uint8_t *buffer, uint16_t size);
+uint8_t RamEepromMcuWriteBuffer(uint16_t addr, uint8_t *buffer, uint16_t size);
+uint8_t RamEepromMcuFlush(void);
+
+static void TestOverlayAtomicWrite(void) {
+  EepromStats_t stats;
+  uint8_t data[EEPROM_OVERLAY_CHUNKS * EEPROM_CHUNK_SIZE];
+
+  Format();
+
+  for (uint i = 0; i < sizeof(data); i++) {
+    data[i] = i ^ 0x5a;
+  }
+
+  // A write the size of the overlay is held as a whole
+  Write(0, data, sizeof(data));
+
+  EepromGetStats(&stats);
+  CHECK_EQ(stats.Flushes, 0);
+
+  EepromMcuFlush();
+  memcpy(Committed, Model, sizeof(Committed));
+
+  // Leave room for 4 more chunks
+  for (uint chunk = 0; chunk < EEPROM_OVERLAY_CHUNKS - 4; chunk++) {
+    Write(chunk * EEPROM_CHUNK_SIZE, data + chunk + 1, 1);
+  }
+
+  EepromResetStats();
+
+  // A group across 10 chunks does not fit next to them, the earlier changes
+  // are flushed before it
+  uint16_t group = NVM_SIZE - 11 * EEPROM_CHUNK_SIZE + 8;
+
+  Write(group, data + 100, 10 * EEPROM_CHUNK_SIZE - 8);
+
+  EepromGetStats(&stats);
+  CHECK_EQ(stats.Flushes, 1);
+  CheckImage();
+
+  // Power lost before the next flush, none of the group was stored
+  EepromMcuInit();
+  memcpy(Model, Committed, sizeof(Model));
+  CheckImage();
+  CHECK(memcmp(Model + group, data + 100, 10 * EEPROM_CHUNK_SIZE - 8) != 0);
+}
+
+/*!
+ * \brief Checks the XIP reads against the RAM cache build given the same
+ *        writes, flushes and reboots
+ *
+ * Writes reach up to a LoRaMac NVM group, so the overlay keeps filling up
+ * and flushing early. Reboots only follow explicit flushes, after which both
+ * builds hold the same image in flash.
+ */
+static void TestAgainstRamCache(void) {
+  static uint8_t data[1200];
+  uint8_t image[NVM_SIZE];
+  uint8_t reference[NVM_SIZE];
+  uint32_t seed = 0xd1ff;
+  uint32_t early = 0;
+  uint32_t reads = 0;
+
+  Format();
+  memset(ram_flash, 0xff, sizeof(ram_flash));
+  RamEepromMcuInit();
+
+  for (uint round = 0; round < 20000; round++) {
+    uint32_t op = test_random(&seed) % 16;
+
+    if (op < 8) {
+      uint16_t size = 1 + test_random(&seed) % (((test_random(&seed) % 16) == 0) ? sizeof(data) : 48);
+      uint16_t addr = test_random(&seed) % (NVM_SIZE - size);
+
+      for (uint i = 0; i < size; i++) {
+        data[i] = ((test_random(&seed) % 4) == 0) ? test_random(&seed) : Model[addr + i];
+      }
+
+      EepromStats_t before;
+      EepromStats_t after;
+
+      EepromGetStats(&before);
+      Write(addr, data, size);
+      EepromGetStats(&after);
+      early += after.Flushes - before.Flushes;
+
+      CHECK_EQ(RamEepromMcuWriteBuffer(addr, data, size), LMN_STATUS_OK);
+    } else if (op < 14) {
+      uint16_t size = 1 + test_random(&seed) % 256;
+      uint16_t addr = test_random(&seed) % (NVM_SIZE - size);
+
+      CHECK_EQ(EepromMcuReadBuffer(addr, image, size), LMN_STATUS_OK);
+      CHECK_EQ(RamEepromMcuReadBuffer(addr, reference, size), LMN_STATUS_OK);
+      CHECK(memcmp(image, reference, size) == 0);
+      CHECK(memcmp(image, Model + addr, size) == 0);
+      reads++;
+    } else {
+      CHECK_EQ(EepromMcuFlush(), LMN_STATUS_OK);
+      CHECK_EQ(RamEepromMcuFlush(), LMN_STATUS_OK);
+
+      if (op == 15) {
+        EepromMcuInit();
+        RamEepromMcuInit();
+      }
+
+      CHECK_EQ(EepromMcuReadBuffer(0, image, sizeof(image)), LMN_STATUS_OK);
+      CHECK_EQ(RamEepromMcuReadBuffer(0, reference, sizeof(reference)), LMN_STATUS_OK);
+      CHECK(memcmp(image, reference, sizeof(image)) == 0);
+      CHECK(memcmp(image, Model, sizeof(image)) == 0);
+    }
+  }
+
+  printf("xip against ram  %u reads, %u flushes for a full overlay\n", reads, early);
+
+  CHECK(early > 50);
+}
+#endif
+
+int main(void) {
+  TestDirtyRuns();
+  TestLegacyMigration();
+  BenchUplinks();
+  TestPowerCuts();
+  TestPowerCutMigration();
+  TestFallbacks();
+  TestEraseGuard();
+#if EEPROM_XIP_READS
+  TestOverlayAtomicWrite();
+  TestAgainstRamCache();
+#endif
+
+  return TEST_RESULT();
+}
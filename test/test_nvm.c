@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Checks when lorawan-nvm.c flushes the NVM changes of the MAC.
+ *
+ * The EEPROM flush functions are replaced by counters, EepromMcuTryFlush
+ * refuses while Refuse is set, as it does when a compaction would erase
+ * flash with an RTC alarm due.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/board-rp2040.h"
+#include "pico/lorawan.h"
+#include "pico/time.h"
+#include "utilities.h"
+
+#include "lorawan-nvm.h"
+#include "test.h"
+
+// Frame counters per reserved block, as in lorawan.c
+#define BLOCK 64
+
+static bool Refuse;
+
+static struct {
+  uint32_t Tries;  // EepromMcuTryFlush calls
+  uint32_t Forced; // EepromMcuFlush calls
+} Calls;
+
+uint8_t EepromMcuTryFlush(void) {
+  Calls.Tries++;
+
+  return Refuse ? LMN_STATUS_ERROR : LMN_STATUS_OK;
+}
+
+uint8_t EepromMcuFlush(void) {
+  Calls.Forced++;
+
+  return LMN_STATUS_OK;
+}
+
+/*!
+ * \brief Lets the changes settle and flushes them while idle
+ */
+static void Settle(void) {
+  stub_time_us += 1000000;
+  lorawan_nvm_process(false, false, true);
+}
+
+static void TestBatching(void) {
+  struct lorawan_nvm_stats stats;
+
+  memset(&Calls, 0, sizeof(Calls));
+
+  // Changes wait for a quiet period
+  lorawan_nvm_stored(1, true);
+  lorawan_nvm_process(false, false, true);
+  CHECK_EQ(Calls.Tries, 0);
+
+  stub_time_us += 50000;
+  lorawan_nvm_stored(2, true);
+  stub_time_us += 50000;
+  lorawan_nvm_process(false, false, true);
+  CHECK_EQ(Calls.Tries, 0);
+
+  Settle();
+  CHECK_EQ(Calls.Tries, 1);
+
+  // Nothing left to flush
+  Settle();
+  CHECK_EQ(Calls.Tries, 1);
+
+  // Stores without changes that must be kept are not flushed
+  lorawan_nvm_stored(3, false);
+  Settle();
+  CHECK_EQ(Calls.Tries, 1);
+
+  lorawan_get_nvm_stats(&stats);
+  CHECK_EQ(stats.stores, 3);
+  CHECK_EQ(stats.flushes, 1);
+  CHECK_EQ(stats.flushes_avoided, 1);
+  CHECK_EQ(Calls.Forced, 0);
+}
+
+static void TestReservedBlock(void) {
+  struct lorawan_nvm_stats stats;
+
+  memset(&Calls, 0, sizeof(Calls));
+
+  // A new block is flushed with the store that reserved it, the block in
+  // flash then covers frames up to 96
+  lorawan_nvm_reserved(BLOCK);
+  lorawan_nvm_stored(BLOCK / 2, true);
+  CHECK_EQ(Calls.Tries, 1);
+
+  Settle();
+  CHECK_EQ(Calls.Tries, 1);
+
+  // Refused while a timer is due, frames the block in flash covers only
+  // retry
+  Refuse = true;
+  lorawan_nvm_reserved(BLOCK + BLOCK / 2);
+  lorawan_nvm_stored(BLOCK, true);
+  CHECK_EQ(Calls.Tries, 2);
+
+  for (uint32_t fcnt = BLOCK + 1; fcnt < BLOCK + BLOCK / 2; fcnt++) {
+    lorawan_nvm_stored(fcnt, false);
+  }
+  CHECK_EQ(Calls.Tries, 2 + BLOCK / 2 - 1);
+  CHECK_EQ(Calls.Forced, 0);
+
+  // Still pending for the main loop
+  Settle();
+  CHECK_EQ(Calls.Tries, 2 + BLOCK / 2);
+  CHECK_EQ(Calls.Forced, 0);
+
+  // The next frame would take a counter past the block in flash. This
+  // store reserves another block, the limit stays the one in flash.
+  lorawan_nvm_reserved(2 * BLOCK);
+  lorawan_nvm_stored(BLOCK + BLOCK / 2, true);
+  CHECK_EQ(Calls.Forced, 1);
+  Refuse = false;
+
+  Settle();
+  lorawan_nvm_stored(BLOCK + BLOCK / 2 + 1, false);
+  CHECK_EQ(Calls.Tries, 2 + BLOCK / 2);
+  CHECK_EQ(Calls.Forced, 1);
+
+  lorawan_get_nvm_stats(&stats);
+  CHECK_EQ(stats.fcnt_reservations, 3);
+}
+
+/*!
+ * \brief Runs the flush before a sleep of lorawan_process_timeout_ms()
+ */
+static void BeforeSleep(bool mac_busy, bool radio_idle) {
+  stub_time_us += 10;
+  lorawan_nvm_process(true, mac_busy, radio_idle);
+}
+
+static void TestSleep(void) {
+  memset(&Calls, 0, sizeof(Calls));
+
+  // No quiet period before sleeping
+  lorawan_nvm_stored(200, true);
+  BeforeSleep(false, true);
+  CHECK_EQ(Calls.Tries, 1);
+
+  BeforeSleep(false, true);
+  CHECK_EQ(Calls.Tries, 1);
+
+  // An RX window is due, the board wakes up for it and flushes afterwards
+  lorawan_nvm_stored(201, true);
+  BeforeSleep(true, true);
+  BeforeSleep(true, false);
+  CHECK_EQ(Calls.Tries, 1);
+
+  BeforeSleep(false, true);
+  CHECK_EQ(Calls.Tries, 2);
+
+  // A receiving radio waits
+  lorawan_nvm_stored(202, true);
+  BeforeSleep(false, false);
+  CHECK_EQ(Calls.Tries, 2);
+
+  BeforeSleep(false, true);
+  CHECK_EQ(Calls.Tries, 3);
+
+  // Refused for a due timer, retried on the next sleep
+  Refuse = true;
+  lorawan_nvm_stored(203, true);
+  BeforeSleep(false, true);
+  CHECK_EQ(Calls.Tries, 4);
+
+  Refuse = false;
+  BeforeSleep(false, true);
+  CHECK_EQ(Calls.Tries, 5);
+
+  BeforeSleep(false, true);
+  CHECK_EQ(Calls.Tries, 5);
+  CHECK_EQ(Calls.Forced, 0);
+
+  // lorawan_flush_nvm() reports a refusal and keeps the changes pending
+  Refuse = true;
+  lorawan_nvm_stored(204, true);
+  CHECK_EQ(lorawan_flush_nvm(), -1);
+  Refuse = false;
+
+  BeforeSleep(false, true);
+  CHECK_EQ(Calls.Tries, 7);
+  CHECK_EQ(lorawan_flush_nvm(), 0);
+}
+
+int main(void) {
+  TestBatching();
+  TestReservedBlock();
+  TestSleep();
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Drives the RTC alarm across the 32-bit microsecond and millisecond wraps.
+ *
+ * The hardware alarm is modelled the way the RP2040 timer behaves: it fires
+ * when the low 32 bits of the microsecond counter match the compare
+ * register, or right away when its force bit is set.
+ */
+
+#include <stdio.h>
+
+#include "hardware/irq.h"
+#include "hardware/timer.h"
+#include "pico/board-rp2040.h"
+#include "pico/time.h"
+#include "rtc-board.h"
+
+#include "test.h"
+
+#define US_WRAP (1ull << 32)
+
+static struct {
+  uint32_t Count;
+  uint64_t At[8];
+} Fired;
+
+static uint32_t AlarmIrqs;
+
+void TimerIrqHandler(void) {
+  if (Fired.Count < count_of(Fired.At)) {
+    Fired.At[Fired.Count] = stub_time_us;
+  }
+  Fired.Count++;
+}
+
+/*!
+ * \brief Moves the clock to until, raising the alarm IRQ on the way
+ */
+static void RunUntil(uint64_t until) {
+  uint32_t mask = 1u << 0;
+
+  while (true) {
+    uint64_t next;
+
+    if ((timer_hw->intf & mask) != 0) {
+      next = stub_time_us;
+    } else if (RtcGetAlarmTarget() != 0) {
+      uint32_t distance = timer_hw->alarm[0] - (uint32_t)stub_time_us;
+
+      // A match at the current time has been handled already
+      next = stub_time_us + ((distance != 0) ? distance : US_WRAP);
+    } else {
+      break;
+    }
+
+    if (next > until) {
+      break;
+    }
+
+    stub_time_us = next;
+    AlarmIrqs++;
+    stub_irq_handlers[RtcGetAlarmIrq()]();
+  }
+
+  stub_time_us = until;
+}
+
+static void Reset(uint64_t now) {
+  RtcStopAlarm();
+  RtcResetAlarmStats();
+  Fired.Count = 0;
+  AlarmIrqs = 0;
+  stub_time_us = now;
+}
+
+static void TestMicrosecondWrap(void) {
+  Reset(US_WRAP - 500);
+
+  uint64_t target = stub_time_us + 1000;
+
+  RtcSetAlarmUs(target);
+  RunUntil(target + 10000);
+
+  CHECK_EQ(Fired.Count, 1);
+  CHECK_EQ(Fired.At[0], target);
+  CHECK_EQ(AlarmIrqs, 1);
+}
+
+static void TestLongAlarm(void) {
+  // Three hours, the compare register matches twice before the target
+  Reset(12345);
+
+  uint64_t target = stub_time_us + 3ull * 3600 * 1000000;
+
+  RtcSetAlarmUs(target);
+  RunUntil(target + 3600ull * 1000000);
+
+  CHECK_EQ(Fired.Count, 1);
+  CHECK_EQ(Fired.At[0], target);
+  CHECK_EQ(AlarmIrqs, 3);
+
+  RtcAlarmStats_t stats;
+
+  RtcGetAlarmStats(&stats);
+  CHECK_EQ(stats.Fired, 1);
+  CHECK_EQ(stats.MaxLatencyUs, 0);
+}
+
+static void TestMillisecondWrap(void) {
+  // Five ticks before the 32-bit tick counter wraps
+  Reset((US_WRAP - 5) * 1000 + 250);
+
+  uint32_t context = RtcSetTimerContext();
+
+  CHECK_EQ(context, 0xFFFFFFFB);
+  CHECK_EQ(RtcGetTimerContext(), context);
+
+  RunUntil(stub_time_us + 10 * 1000);
+
+  CHECK_EQ(RtcGetTimerValue(), 5);
+  CHECK_EQ(RtcGetTimerElapsedTime(), 10);
+  CHECK_EQ((uint32_t)(RtcGetTimerValue() - context), 10);
+  CHECK_EQ(RtcTick2Ms(RtcMs2Tick(10)), 10);
+
+  // Timeouts are relative to the context, across the wrap
+  uint64_t contextUs = (US_WRAP - 5) * 1000 + 250;
+
+  RtcSetAlarm(20);
+  RunUntil(contextUs + 60 * 1000);
+
+  CHECK_EQ(Fired.Count, 1);
+  CHECK_EQ(Fired.At[0], contextUs + 20 * 1000);
+}
+
+static void TestPastTarget(void) {
+  Reset(US_WRAP + 777);
+
+  RtcSetAlarmUs(stub_time_us - 1);
+  RunUntil(stub_time_us + 1000);
+
+  CHECK_EQ(Fired.Count, 1);
+  CHECK_EQ(Fired.At[0], US_WRAP + 777);
+}
+
+static void TestRescheduleAndStop(void) {
+  Reset(US_WRAP - 2000);
+
+  uint64_t start = stub_time_us;
+
+  // Moving the alarm earlier replaces the later target
+  RtcSetAlarmUs(start + 5000);
+  RtcSetAlarmUs(start + 3000);
+  RunUntil(start + 10000);
+
+  CHECK_EQ(Fired.Count, 1);
+  CHECK_EQ(Fired.At[0], start + 3000);
+
+  // A stopped alarm never fires, not even when its compare value matches
+  RtcSetAlarmUs(start + 20000);
+  RtcStopAlarm();
+  RunUntil(start + US_WRAP + 30000);
+
+  CHECK_EQ(Fired.Count, 1);
+}
+
+static void TestDeferral(void) {
+  Reset(US_WRAP * 3 - 100);
+
+  uint64_t target = stub_time_us + 200;
+
+  RtcSetAlarmUs(target);
+  RtcDeferAlarms(true);
+  RunUntil(target + 5000);
+
+  CHECK_EQ(Fired.Count, 0);
+
+  // Raised again once flash is accessible
+  RtcDeferAlarms(false);
+  RunUntil(stub_time_us);
+
+  CHECK_EQ(Fired.Count, 1);
+  CHECK_EQ(Fired.At[0], target + 5000);
+
+  RunUntil(stub_time_us + US_WRAP);
+  CHECK_EQ(Fired.Count, 1);
+}
+
+int main(void) {
+  RtcInit();
+
+  TestMicrosecondWrap();
+  TestLongAlarm();
+  TestMillisecondWrap();
+  TestPastTarget();
+  TestRescheduleAndStop();
+  TestDeferral();
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,491 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Counts the SPI transactions, calls and bytes each SX126x access costs.
+ *
+ * The SPI block and DMA channels are replaced by a model of the radio that
+ * keeps a 256 byte data buffer, so FIFO writes can be read back. A
+ * transaction is an NSS falling edge, or a command word on the PIO engine,
+ * whose state machine can be made to stall.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/spi.h"
+#include "pico/board-rp2040.h"
+#include "sx126x-board.h"
+#include "utilities.h"
+
+#include "test.h"
+
+SX126x_t SX126x;
+
+static struct {
+  uint32_t Transactions;
+  uint32_t Bytes;
+  uint32_t Position; //! Byte index within the current transaction
+  uint8_t Opcode;
+  uint8_t Offset;
+  uint8_t Buffer[256];
+} Radio;
+
+static spi_hw_t SpiHw;
+
+static struct {
+  const volatile uint8_t *Read;
+  volatile uint8_t *Write;
+  uint Count;
+  bool ReadIncrement;
+  bool WriteIncrement;
+} DmaChannels[NUM_DMA_CHANNELS];
+
+static int DmaClaimed = 0;
+
+static uint32_t DmaPending = 0;
+
+static uint32_t DmaStarts = 0;
+
+/*!
+ * \brief Clocks one byte through the radio model
+ */
+static uint8_t RadioByte(uint8_t out) {
+  uint32_t position = Radio.Position++;
+  uint8_t in = 0x00;
+
+  Radio.Bytes++;
+
+  if (position == 0) {
+    Radio.Opcode = out;
+  } else if ((Radio.Opcode == RADIO_WRITE_BUFFER) || (Radio.Opcode == RADIO_READ_BUFFER)) {
+    if (position == 1) {
+      Radio.Offset = out;
+    } else if (Radio.Opcode == RADIO_WRITE_BUFFER) {
+      Radio.Buffer[Radio.Offset++] = out;
+    } else if (position > 2) {
+      in = Radio.Buffer[Radio.Offset++];
+    }
+  }
+
+  return in;
+}
+
+void GpioInit(Gpio_t *obj, PinNames pin, PinModes mode, PinConfigs config, PinTypes type, uint32_t value) {
+  obj->pin = pin;
+}
+
+void GpioSetInterrupt(Gpio_t *obj, IrqModes irqMode, IrqPriorities irqPriority, GpioIrqHandler *irqHandler) {}
+
+void GpioWrite(Gpio_t *obj, uint32_t value) {
+  if ((obj == &SX126x.Spi.Nss) && (value == 0)) {
+    Radio.Transactions++;
+    Radio.Position = 0;
+  }
+}
+
+uint32_t GpioRead(Gpio_t *obj) {
+  // BUSY is always low
+  return 0;
+}
+
+uint spi_init(spi_inst_t *spi, uint baudrate) { return baudrate; }
+
+uint spi_set_baudrate(spi_inst_t *spi, uint baudrate) { return baudrate; }
+
+spi_hw_t *spi_get_hw(spi_inst_t *spi) { return &SpiHw; }
+
+int spi_write_read_blocking(spi_inst_t *spi, const uint8_t *src, uint8_t *dst, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    dst[i] = RadioByte(src[i]);
+  }
+  return len;
+}
+
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    RadioByte(src[i]);
+  }
+  return len;
+}
+
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    dst[i] = RadioByte(repeated_tx_data);
+  }
+  return len;
+}
+
+int dma_claim_unused_channel(bool required) { return DmaClaimed++; }
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger) {
+  DmaChannels[channel].Read = read_addr;
+  DmaChannels[channel].Write = write_addr;
+  DmaChannels[channel].Count = transfer_count;
+  DmaChannels[channel].ReadIncrement = config->read_increment;
+  DmaChannels[channel].WriteIncrement = config->write_increment;
+}
+
+void dma_start_channel_mask(uint32_t chan_mask) {
+  int tx = -1;
+  int rx = -1;
+
+  // The TX channel reads memory, the RX channel writes it
+  for (uint ch = 0; ch < NUM_DMA_CHANNELS; ch++) {
+    if ((chan_mask & (1u << ch)) == 0) {
+      continue;
+    }
+    if (DmaChannels[ch].Write == (volatile uint8_t *)&SpiHw.dr) {
+      tx = ch;
+    } else {
+      rx = ch;
+    }
+  }
+
+  CHECK((tx >= 0) && (rx >= 0));
+  DmaStarts++;
+  CHECK_EQ(DmaChannels[tx].Count, DmaChannels[rx].Count);
+
+  for (uint i = 0; i < DmaChannels[tx].Count; i++) {
+    uint8_t in = RadioByte(*DmaChannels[tx].Read);
+
+    *DmaChannels[rx].Write = in;
+    if (DmaChannels[tx].ReadIncrement) {
+      DmaChannels[tx].Read++;
+    }
+    if (DmaChannels[rx].WriteIncrement) {
+      DmaChannels[rx].Write++;
+    }
+  }
+
+  // The completion IRQ is delivered on the next WFE
+  DmaPending |= 1u << rx;
+}
+
+bool dma_channel_is_busy(uint channel) {
+  CHECK(channel < NUM_DMA_CHANNELS);
+  return false;
+}
+
+bool dma_channel_get_irq0_status(uint channel) { return (DmaPending & (1u << channel)) != 0; }
+
+void dma_channel_acknowledge_irq0(uint channel) { DmaPending &= ~(1u << channel); }
+
+/*!
+ * PIO state machine model, a transaction starts with a command word holding
+ * the byte count and every byte put is clocked through the radio
+ */
+static struct {
+  uint32_t Remaining; //! Bytes left in the transaction, 0 when idle
+  uint8_t Rx[512];
+  uint32_t RxHead;
+  uint32_t RxTail;
+  bool StallRx;       //! The received bytes never show up
+  bool StallPc;       //! The program does not return to its start
+  uint32_t Restarts;
+} Pio;
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data) {
+  if (Pio.Remaining == 0) {
+    Radio.Transactions++;
+    Radio.Position = 0;
+    Pio.Remaining = (data & 0x7fffffff) + 1;
+    return;
+  }
+
+  uint8_t in = RadioByte(data >> 24);
+
+  if (!Pio.StallRx) {
+    Pio.Rx[Pio.RxHead++ % sizeof(Pio.Rx)] = in;
+  }
+  Pio.Remaining--;
+}
+
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm) { return false; }
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm) {
+  if (Pio.RxHead == Pio.RxTail) {
+    // Time passes while the CPU polls
+    stub_time_us += 10;
+    return true;
+  }
+  return false;
+}
+
+uint32_t pio_sm_get(PIO pio, uint sm) { return Pio.Rx[Pio.RxTail++ % sizeof(Pio.Rx)]; }
+
+uint8_t pio_sm_get_pc(PIO pio, uint sm) {
+  if (Pio.StallPc || (Pio.Remaining != 0)) {
+    stub_time_us += 10;
+    return 1;
+  }
+  return 0;
+}
+
+void pio_sm_restart(PIO pio, uint sm) {
+  Pio.Remaining = 0;
+  Pio.RxHead = Pio.RxTail = 0;
+  Pio.StallPc = false;
+  Pio.Restarts++;
+}
+
+static void DeliverDmaIrq(void) {
+  if ((DmaPending != 0) && (stub_irq_handlers[DMA_IRQ_0] != NULL)) {
+    stub_irq_handlers[DMA_IRQ_0]();
+  }
+}
+
+void SX126xCheckDeviceReady(void) {}
+
+void SX126xCalibrate(CalibrationParams_t calibParam) {}
+
+void SX126xSetDio2AsRfSwitchCtrl(uint8_t enable) {}
+
+void SX126xSetDio3AsTcxoCtrl(RadioTcxoCtrlVoltages_t tcxoVoltage, uint32_t timeout) {}
+
+void SX126xSetTxParams(int8_t power, RadioRampTimes_t rampTime) {}
+
+uint8_t EepromMcuWriteBuffer(uint16_t addr, uint8_t *buffer, uint16_t size) { return LMN_STATUS_OK; }
+
+uint8_t EepromMcuReadBuffer(uint16_t addr, uint8_t *buffer, uint16_t size) {
+  memset(buffer, 0xFF, size);
+  return LMN_STATUS_OK;
+}
+
+/*!
+ * \brief Cost of one access
+ */
+typedef struct {
+  uint32_t Transactions;
+  uint32_t Calls;
+  uint32_t Bytes;
+} Cost_t;
+
+static Cost_t Start;
+
+static void Begin(void) {
+  SpiStats_t stats;
+
+  SpiGetStats(&stats);
+  Start.Transactions = Radio.Transactions;
+  Start.Calls = stats.Calls;
+  Start.Bytes = Radio.Bytes;
+}
+
+static Cost_t End(void) {
+  SpiStats_t stats;
+
+  // Let a FIFO load still in flight complete
+  SpiWaitIdle(&SX126x.Spi);
+
+  SpiGetStats(&stats);
+  return (Cost_t){
+      .Transactions = Radio.Transactions - Start.Transactions,
+      .Calls = stats.Calls - Start.Calls,
+      .Bytes = Radio.Bytes - Start.Bytes,
+  };
+}
+
+/*!
+ * \brief Checks an access against the expected cost and prints a table row
+ *
+ * The upstream board layer sends every access and runs one SpiInOut call
+ * per byte, baseline is its call count.
+ */
+static void Expect(const char *name, Cost_t cost, uint32_t transactions, uint32_t calls, uint32_t bytes,
+                   uint32_t baseline) {
+  printf("%-28s %12u %10u %6u %14u\n", name, cost.Transactions, cost.Calls, cost.Bytes, baseline);
+
+  CHECK_EQ(cost.Transactions, transactions);
+  CHECK_EQ(cost.Calls, calls);
+  CHECK_EQ(cost.Bytes, bytes);
+}
+
+/*!
+ * \brief Runs accesses on the PIO engine, including ones it times out on
+ */
+static void TestPio(void) {
+  uint8_t params[8] = {0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18};
+  uint8_t sync[2] = {0x12, 0x34};
+  uint8_t value[2];
+  uint32_t timeouts = SX126xGetBusyTimeouts(NULL);
+
+  SpiPioInit(&SX126x.Spi, NULL, 0, 0, 0, 0, NC);
+  CHECK(SpiIsPio(&SX126x.Spi));
+
+  Begin();
+  SX126xWriteRegisters(REG_LR_SYNCWORD, sync, 2);
+  Expect("PIO WriteRegisters", End(), 1, 1, 3 + 2, 3 + 2);
+
+  // A write the engine timed out on is sent again, the radio may not hold it
+  sync[1] = 0x56;
+  Pio.StallRx = true;
+  SX126xWriteRegisters(REG_LR_SYNCWORD, sync, 2);
+  Pio.StallRx = false;
+  CHECK_EQ(SX126xGetBusyTimeouts(NULL), timeouts + 1);
+  CHECK_EQ(Pio.Restarts, 1);
+
+  Begin();
+  SX126xWriteRegisters(REG_LR_SYNCWORD, sync, 2);
+  Expect("PIO WriteRegisters retried", End(), 1, 1, 3 + 2, 3 + 2);
+
+  Begin();
+  SX126xReadRegisters(REG_LR_SYNCWORD, value, 2);
+  Expect("PIO ReadRegisters shadowed", End(), 0, 0, 0, 4 + 2);
+  CHECK((value[0] == sync[0]) && (value[1] == sync[1]));
+
+  Pio.StallRx = true;
+  SX126xWriteCommand(RADIO_SET_MODULATIONPARAMS, params, 8);
+  Pio.StallRx = false;
+
+  Begin();
+  SX126xWriteCommand(RADIO_SET_MODULATIONPARAMS, params, 8);
+  Expect("PIO SetModulation retried", End(), 1, 1, 1 + 8, 1 + 8);
+
+  Begin();
+  SX126xWriteCommand(RADIO_SET_MODULATIONPARAMS, params, 8);
+  Expect("PIO SetModulation again", End(), 0, 0, 0, 1 + 8);
+
+  // The engine never returning to its start is a timeout too
+  Pio.StallPc = true;
+  sync[1] = 0x78;
+  SX126xWriteRegisters(REG_LR_SYNCWORD, sync, 2);
+  CHECK(!Pio.StallPc);
+  CHECK_EQ(Pio.Restarts, 3);
+
+  Begin();
+  SX126xWriteRegisters(REG_LR_SYNCWORD, sync, 2);
+  Expect("PIO WriteRegisters after stall", End(), 1, 1, 3 + 2, 3 + 2);
+
+  // A read that timed out does not fill the shadow
+  SX126xWriteCommand(RADIO_SET_SLEEP, (uint8_t[]){0x00}, 1);
+  Pio.StallRx = true;
+  SX126xReadRegisters(REG_LR_SYNCWORD, value, 2);
+  Pio.StallRx = false;
+
+  Begin();
+  SX126xReadRegisters(REG_LR_SYNCWORD, value, 2);
+  Expect("PIO ReadRegisters retried", End(), 1, 1, 4 + 2, 4 + 2);
+}
+
+int main(void) {
+  uint8_t params[8] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+  uint8_t payload[242];
+  uint8_t readback[sizeof(payload)];
+  uint8_t status[2];
+  uint8_t sync[2] = {0x34, 0x44};
+  uint8_t value[2];
+
+  stub_event_hook = DeliverDmaIrq;
+
+  // Waiting from an IRQ handler before the DMA channels are claimed must not
+  // poll channel -1
+  stub_exception = 16 + IO_IRQ_BANK0;
+  SpiWaitIdle(&SX126x.Spi);
+  stub_exception = 0;
+  CHECK(!SpiIsBusy(&SX126x.Spi));
+
+  SpiInit(&SX126x.Spi, 0, 0, 0, 0, 0);
+  SX126xIoInit();
+
+  for (uint i = 0; i < sizeof(payload); i++) {
+    payload[i] = i * 7;
+  }
+
+  printf("%-28s %12s %10s %6s %14s\n", "access", "transactions", "spi calls", "bytes",
+         "baseline calls");
+
+  Begin();
+  SX126xWriteCommand(RADIO_SET_MODULATIONPARAMS, params, 8);
+  Expect("SetModulationParams", End(), 1, 2, 1 + 8, 1 + 8);
+
+  Begin();
+  SX126xWriteCommand(RADIO_SET_MODULATIONPARAMS, params, 8);
+  Expect("SetModulationParams again", End(), 0, 0, 0, 1 + 8);
+
+  Begin();
+  SX126xWriteCommand(RADIO_SET_TX, params, 3);
+  Expect("SetTx", End(), 1, 2, 1 + 3, 1 + 3);
+
+  Begin();
+  SX126xReadCommand(RADIO_GET_IRQSTATUS, status, 2);
+  Expect("GetIrqStatus", End(), 1, 2, 2 + 2, 2 + 2);
+
+  Begin();
+  SX126xWriteRegisters(REG_LR_SYNCWORD, sync, 2);
+  Expect("WriteRegisters syncword", End(), 1, 2, 3 + 2, 3 + 2);
+
+  Begin();
+  SX126xWriteRegisters(REG_LR_SYNCWORD, sync, 2);
+  Expect("WriteRegisters again", End(), 0, 0, 0, 3 + 2);
+
+  Begin();
+  SX126xReadRegisters(REG_LR_SYNCWORD, value, 2);
+  Expect("ReadRegisters shadowed", End(), 0, 0, 0, 4 + 2);
+  CHECK((value[0] == sync[0]) && (value[1] == sync[1]));
+
+  Begin();
+  SX126xReadRegister(0x0889);
+  Expect("ReadRegister", End(), 1, 2, 4 + 1, 4 + 1);
+
+  // FIFO loads run through DMA, reads block as the driver needs the data
+  uint32_t dmaStarts = DmaStarts;
+
+  Begin();
+  SX126xWriteBuffer(0, payload, sizeof(payload));
+  Expect("WriteBuffer 242", End(), 1, 2, 2 + 242, 2 + 242);
+  CHECK_EQ(DmaStarts - dmaStarts, 1);
+
+  Begin();
+  SX126xReadBuffer(0, readback, sizeof(readback));
+  Expect("ReadBuffer 242", End(), 1, 2, 3 + 242, 3 + 242);
+  CHECK(memcmp(payload, readback, sizeof(payload)) == 0);
+  CHECK_EQ(DmaStarts - dmaStarts, 1);
+
+  Begin();
+  SX126xWriteBuffer(0, payload, 8);
+  Expect("WriteBuffer 8", End(), 1, 2, 2 + 8, 2 + 8);
+
+  // From an IRQ handler a transfer owned by another object is left alone,
+  // and the owner's own transfer completes in place
+  Spi_t other = {0};
+
+  SX126xWriteBuffer(0, payload, sizeof(payload));
+  stub_exception = 16 + IO_IRQ_BANK0;
+  SpiWaitIdle(&other);
+  CHECK(SpiIsBusy(&SX126x.Spi));
+  SpiWaitIdle(&SX126x.Spi);
+  CHECK(!SpiIsBusy(&SX126x.Spi));
+  stub_exception = 0;
+
+  // A warm sleep keeps the retained registers only
+  SX126xWriteRegister(REG_OCP, 0x38);
+  SX126xWriteCommand(RADIO_SET_SLEEP, (uint8_t[]){0x04}, 1);
+
+  Begin();
+  SX126xReadRegisters(REG_LR_SYNCWORD, value, 2);
+  Expect("ReadRegisters after warm", End(), 0, 0, 0, 4 + 2);
+
+  Begin();
+  SX126xReadRegister(REG_OCP);
+  Expect("ReadRegister OCP after warm", End(), 1, 2, 4 + 1, 4 + 1);
+
+  Begin();
+  SX126xWriteCommand(RADIO_SET_MODULATIONPARAMS, params, 8);
+  Expect("SetModulationParams warm", End(), 0, 0, 0, 1 + 8);
+
+  // A cold sleep drops everything
+  SX126xWriteCommand(RADIO_SET_SLEEP, (uint8_t[]){0x00}, 1);
+
+  Begin();
+  SX126xWriteCommand(RADIO_SET_MODULATIONPARAMS, params, 8);
+  Expect("SetModulationParams cold", End(), 1, 2, 1 + 8, 1 + 8);
+
+  TestPio();
+
+  return TEST_RESULT();
+}
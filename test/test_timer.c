@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Checks the ordering of the heap timer engine and measures how TimerStart
+ * and TimerStop scale with the number of running timers.
+ *
+ * Built with a TIMER_HEAP_SIZE of BENCH_MAX_TIMERS, the RTC is replaced by a
+ * single alarm slot fired by RunUntil.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "pico/board-rp2040.h"
+#include "pico/time.h"
+#include "timer.h"
+#include "utilities.h"
+
+#include "test.h"
+
+#define BENCH_MAX_TIMERS TIMER_HEAP_SIZE
+
+#define BENCH_OPS 200000
+
+static uint64_t AlarmTarget = 0;
+
+void RtcSetAlarmUs(uint64_t target) { AlarmTarget = target; }
+
+void RtcStopAlarm(void) { AlarmTarget = 0; }
+
+uint32_t RtcGetMinimumTimeout(void) { return 1; }
+
+uint32_t RtcMs2Tick(TimerTime_t milliseconds) { return milliseconds; }
+
+TimerTime_t RtcTick2Ms(uint32_t tick) { return tick; }
+
+uint32_t RtcGetTimerValue(void) { return (uint32_t)(stub_time_us / 1000); }
+
+TimerTime_t RtcTempCompensation(TimerTime_t period, float temperature) { return period; }
+
+void RtcProcess(void) {}
+
+static TimerEvent_t Timers[BENCH_MAX_TIMERS + 1];
+
+static struct {
+  uint32_t Count;
+  int Order[64];
+  uint64_t At[64];
+} Fired;
+
+static void OnTimer(void *context) {
+  int id = (int)(intptr_t)context;
+
+  if (Fired.Count < count_of(Fired.Order)) {
+    Fired.Order[Fired.Count] = id;
+    Fired.At[Fired.Count] = stub_time_us;
+  }
+  Fired.Count++;
+}
+
+/*!
+ * \brief Moves the clock to until, firing the alarm on the way
+ */
+static void RunUntil(uint64_t until) {
+  while ((AlarmTarget != 0) && (AlarmTarget <= until)) {
+    stub_time_us = AlarmTarget;
+    AlarmTarget = 0;
+    TimerIrqHandler();
+  }
+
+  stub_time_us = until;
+}
+
+static void StartTimer(int id, uint32_t ms) {
+  TimerSetValue(&Timers[id], ms);
+  TimerStart(&Timers[id]);
+}
+
+static void Reset(void) {
+  for (uint i = 0; i < count_of(Timers); i++) {
+    TimerStop(&Timers[i]);
+  }
+  Fired.Count = 0;
+  CHECK_EQ(AlarmTarget, 0);
+}
+
+static void TestEqualExpiryOrder(void) {
+  Reset();
+
+  // Equal expiries fire in the order the timers were started
+  StartTimer(3, 100);
+  StartTimer(1, 50);
+  StartTimer(4, 100);
+  StartTimer(0, 50);
+  StartTimer(2, 50);
+  StartTimer(5, 100);
+
+  RunUntil(stub_time_us + 1000 * 1000);
+
+  int expected[] = {1, 0, 2, 3, 4, 5};
+
+  CHECK_EQ(Fired.Count, count_of(expected));
+  for (uint i = 0; i < count_of(expected); i++) {
+    CHECK_EQ(Fired.Order[i], expected[i]);
+  }
+  CHECK_EQ(Fired.At[2] - Fired.At[0], 0);
+  CHECK_EQ(Fired.At[3] - Fired.At[0], 50 * 1000);
+}
+
+static void TestStopNonRoot(void) {
+  Reset();
+
+  uint64_t start = stub_time_us;
+
+  for (int id = 0; id < 16; id++) {
+    StartTimer(id, 10 * (id + 1));
+  }
+
+  // Stopping timers below the root leaves the alarm alone
+  TimerStop(&Timers[7]);
+  TimerStop(&Timers[15]);
+  TimerStop(&Timers[1]);
+  CHECK(!TimerIsStarted(&Timers[7]));
+  CHECK_EQ(AlarmTarget, start + 10 * 1000);
+  CHECK(Timers[0].IsNext2Expire);
+
+  // Stopping the root moves the alarm to the next one
+  TimerStop(&Timers[0]);
+  CHECK_EQ(AlarmTarget, start + 30 * 1000);
+  CHECK(Timers[2].IsNext2Expire);
+
+  RunUntil(start + 1000 * 1000);
+
+  CHECK_EQ(Fired.Count, 12);
+  for (uint i = 0, id = 2; i < Fired.Count; i++, id++) {
+    if ((id == 7) || (id == 15)) {
+      id++;
+    }
+    CHECK_EQ(Fired.Order[i], id);
+    CHECK_EQ(Fired.At[i], start + 10 * 1000 * (id + 1));
+  }
+}
+
+static void TestRandomAgainstModel(void) {
+  uint32_t seed = 0x1234567;
+  uint64_t expiry[32] = {0};
+
+  Reset();
+
+  // Random starts and stops, then every timer still running must fire at
+  // its expiry, in expiry order
+  for (uint round = 0; round < 2000; round++) {
+    int id = test_random(&seed) % count_of(expiry);
+
+    if (TimerIsStarted(&Timers[id]) && ((test_random(&seed) & 1) != 0)) {
+      TimerStop(&Timers[id]);
+      expiry[id] = 0;
+    } else {
+      uint32_t ms = 1 + test_random(&seed) % 5000;
+
+      StartTimer(id, ms);
+      expiry[id] = stub_time_us + (uint64_t)ms * 1000;
+    }
+  }
+
+  RunUntil(stub_time_us + 10 * 1000 * 1000);
+
+  uint64_t last = 0;
+
+  for (uint i = 0; i < MIN(Fired.Count, count_of(Fired.Order)); i++) {
+    CHECK_EQ(Fired.At[i], expiry[Fired.Order[i]]);
+    CHECK(Fired.At[i] >= last);
+    last = Fired.At[i];
+  }
+
+  uint32_t running = 0;
+
+  for (uint id = 0; id < count_of(expiry); id++) {
+    running += (expiry[id] != 0);
+  }
+  CHECK_EQ(Fired.Count, running);
+}
+
+static void TestCapacityPanic(void) {
+  jmp_buf target;
+
+  Reset();
+
+  for (int id = 0; id < TIMER_HEAP_SIZE; id++) {
+    StartTimer(id, 1000 + id);
+  }
+
+  if (setjmp(target) == 0) {
+    stub_expect_panic(&target);
+    StartTimer(TIMER_HEAP_SIZE, 10);
+    CHECK(!"TimerStart did not panic with TIMER_HEAP_SIZE timers running");
+  }
+  stub_expect_panic(NULL);
+
+  CHECK(!TimerIsStarted(&Timers[TIMER_HEAP_SIZE]));
+}
+
+static double NowNs(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*!
+ * \brief Measures a TimerStop plus TimerStart pair with n timers running
+ *
+ * A random timer restarted with a random timeout moves a constant number of
+ * heap levels on average. The worst case restarts the earliest timer as the
+ * earliest again: the stop sifts the last entry down from the root and the
+ * start sifts the new entry up from the bottom, log2(n) levels each.
+ *
+ * \param [IN] n     Running timers
+ * \param [IN] worst Measure the worst case instead of random restarts
+ *
+ * \retval ns Mean time per pair [ns]
+ */
+static double Bench(uint n, bool worst) {
+  uint32_t seed = 0xC0FFEE ^ n;
+
+  Reset();
+
+  for (uint id = 0; id < n; id++) {
+    StartTimer(id, 1000 + test_random(&seed) % 100000);
+  }
+
+  double start = NowNs();
+
+  for (uint op = 0; op < BENCH_OPS; op++) {
+    int id = worst ? 0 : test_random(&seed) % n;
+
+    TimerStop(&Timers[id]);
+    Timers[id].ReloadValue = worst ? 1 : 1000 + test_random(&seed) % 100000;
+    TimerStart(&Timers[id]);
+  }
+
+  return (NowNs() - start) / BENCH_OPS;
+}
+
+static void BenchScaling(void) {
+  double first = 0;
+  double last = 0;
+
+  printf("%8s %16s %16s %14s\n", "timers", "random ns/pair", "worst ns/pair", "worst/log2(n)");
+
+  for (uint n = 16; n <= BENCH_MAX_TIMERS; n *= 4) {
+    double random = Bench(n, false);
+    double worst = Bench(n, true);
+    uint levels = 0;
+
+    while ((1u << levels) < n) {
+      levels++;
+    }
+
+    printf("%8u %16.1f %16.1f %14.1f\n", n, random, worst, worst / levels);
+
+    if (first == 0) {
+      first = worst;
+    }
+    last = worst;
+  }
+
+  // 256 times the timers is 3x the levels. A sorted list would walk 256x
+  // the entries, below 16x leaves room for cache effects and noise.
+  printf("worst case ratio %u/16 timers: %.1f\n", BENCH_MAX_TIMERS, last / first);
+  CHECK(last / first < 16);
+
+  Reset();
+}
+
+int main(void) {
+  stub_time_us = 1000;
+
+  for (uint id = 0; id < count_of(Timers); id++) {
+    TimerInit(&Timers[id], OnTimer);
+    TimerSetContext(&Timers[id], (void *)(intptr_t)id);
+  }
+
+  TestEqualExpiryOrder();
+  TestStopNonRoot();
+  TestRandomAgainstModel();
+  TestCapacityPanic();
+  BenchScaling();
+
+  return TEST_RESULT();
+}